@@ -0,0 +1,489 @@
+#define _GNU_SOURCE
+#include "tls_loadgen.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PING_SIZE 16
+#define READ_SIZE 16384
+#define MAX_THREADS 256
+#define MAX_CONNECTIONS 65536
+/* A thread gives up on a phase once errors outnumber completed work. */
+#define MIN_ERRORS_TO_ABORT 100
+
+/* Log-linear latency histogram in nanoseconds: 16 sub-buckets per power of
+ * two, so a reported percentile is within about 6% of the true value. */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+};
+
+enum phase { PHASE_FULL, PHASE_RESUMED, PHASE_BULK };
+
+enum slot_state { SLOT_IDLE, SLOT_CONNECTING, SLOT_HANDSHAKE, SLOT_PING, SLOT_BULK };
+
+struct slot {
+    enum slot_state state;
+    int fd;
+    void *conn;
+    void *session;
+    short events;
+    size_t sent;
+    size_t received;
+    uint64_t start;
+};
+
+struct options {
+    const char *host;
+    const char *port;
+    struct addrinfo *addr;
+    int connections;
+    int threads;
+    double seconds;
+    size_t message_size;
+};
+
+struct loadgen_thread {
+    pthread_t thread;
+    const struct tls_loadgen_backend *backend;
+    const struct options *opts;
+    enum phase phase;
+    void *ctx;
+    struct slot *slots;
+    int nslots;
+    unsigned char *out;
+    unsigned char *in;
+    uint64_t end;
+    uint64_t measure_start;
+    int established;
+    int aborted;
+    long handshakes;
+    long resumed;
+    long errors;
+    uint64_t bytes;
+    double bytes_per_second;
+    struct histogram hist;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int hist_index(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_value(int index) {
+    if (index < HIST_SUB) return (uint64_t)index;
+    int shift = (index >> HIST_SUB_BITS) - 1;
+    return (uint64_t)(HIST_SUB + (index & (HIST_SUB - 1))) << shift;
+}
+
+static void hist_add(struct histogram *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    h->total++;
+}
+
+static void hist_merge(struct histogram *into, const struct histogram *from) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+}
+
+static uint64_t hist_percentile(const struct histogram *h, double p) {
+    uint64_t rank = (uint64_t)(p * (double)h->total);
+    uint64_t seen = 0;
+    if (rank >= h->total) rank = h->total - 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank) return hist_value(i);
+    }
+    return 0;
+}
+
+static void close_slot(struct loadgen_thread *t, struct slot *s) {
+    if (s->conn) t->backend->conn_free(s->conn);
+    if (s->fd >= 0) close(s->fd);
+    s->conn = NULL;
+    s->fd = -1;
+    s->events = 0;
+    s->state = SLOT_IDLE;
+}
+
+static int start_connect(struct loadgen_thread *t, struct slot *s) {
+    const struct addrinfo *ai = t->opts->addr;
+    int one = 1;
+
+    s->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+    if (s->fd < 0) return -1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(s->fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+    s->state = SLOT_CONNECTING;
+    s->events = POLLOUT;
+    return 0;
+}
+
+static short want_to_events(int ret) {
+    return ret == TLS_LOADGEN_WANT_WRITE ? POLLOUT : POLLIN;
+}
+
+/* Writes len bytes and reads their echo, reading while the write is still
+ * pending so neither side can fill its buffers and stall. Returns 1 once
+ * the echo is complete, 0 to wait for s->events, -1 on error. */
+static int exchange(struct loadgen_thread *t, struct slot *s, size_t len) {
+    const struct tls_loadgen_backend *b = t->backend;
+    short events = 0;
+    int ret;
+
+    while (s->sent < len) {
+        ret = b->write(s->conn, t->out + s->sent, len - s->sent);
+        if (ret == TLS_LOADGEN_WANT_READ || ret == TLS_LOADGEN_WANT_WRITE) {
+            events |= want_to_events(ret);
+            break;
+        }
+        if (ret <= 0) return -1;
+        s->sent += (size_t)ret;
+    }
+    while (s->received < s->sent) {
+        ret = b->read(s->conn, t->in, READ_SIZE);
+        if (ret == TLS_LOADGEN_WANT_READ || ret == TLS_LOADGEN_WANT_WRITE) {
+            events |= want_to_events(ret);
+            break;
+        }
+        if (ret <= 0) return -1;
+        s->received += (size_t)ret;
+    }
+    if (s->received >= len) return 1;
+    s->events = events;
+    return 0;
+}
+
+/* Advances a slot until it has to wait for its socket. Handshake phases
+ * cycle connect, handshake, one short echo and close; the bulk phase keeps
+ * its connection and echoes message_size bytes at a time. */
+static void slot_step(struct loadgen_thread *t, struct slot *s) {
+    const struct tls_loadgen_backend *b = t->backend;
+    int ret, err;
+    socklen_t len;
+
+    while (1) {
+        switch (s->state) {
+        case SLOT_IDLE:
+            if (start_connect(t, s) != 0) goto fail;
+            return;
+
+        case SLOT_CONNECTING:
+            err = 0;
+            len = sizeof(err);
+            if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) goto fail;
+            s->conn = b->conn_new(t->ctx, s->fd, t->opts->host, t->phase == PHASE_RESUMED ? s->session : NULL);
+            if (!s->conn) goto fail;
+            s->state = SLOT_HANDSHAKE;
+            break;
+
+        case SLOT_HANDSHAKE:
+            ret = b->handshake(s->conn);
+            if (ret == TLS_LOADGEN_WANT_READ || ret == TLS_LOADGEN_WANT_WRITE) {
+                s->events = want_to_events(ret);
+                return;
+            }
+            if (ret != 0) goto fail;
+            s->sent = s->received = 0;
+            s->start = now_ns();
+            if (t->phase == PHASE_BULK) {
+                s->state = SLOT_BULK;
+                if (++t->established == t->nslots) t->measure_start = s->start;
+            } else {
+                s->state = SLOT_PING;
+            }
+            break;
+
+        case SLOT_PING:
+            ret = exchange(t, s, PING_SIZE);
+            if (ret == 0) return;
+            if (ret < 0) goto fail;
+            t->handshakes++;
+            if (b->resumed && b->resumed(s->conn) == 1) t->resumed++;
+            if (t->phase == PHASE_RESUMED) {
+                /* TLS 1.3 tickets arrive after the handshake, so the
+                 * session is taken once the echo has been read. */
+                if (s->session) b->session_free(s->session);
+                s->session = b->session_get(s->conn);
+            }
+            close_slot(t, s);
+            if (now_ns() >= t->end) return;
+            break;
+
+        case SLOT_BULK:
+            ret = exchange(t, s, t->opts->message_size);
+            if (ret == 0) return;
+            if (ret < 0) goto fail;
+            if (t->measure_start && s->start >= t->measure_start) {
+                uint64_t done = now_ns();
+                hist_add(&t->hist, done - s->start);
+                t->bytes += t->opts->message_size;
+            }
+            s->sent = s->received = 0;
+            s->start = now_ns();
+            if (s->start >= t->end) return;
+            break;
+        }
+    }
+
+fail:
+    t->errors++;
+    if (s->state == SLOT_BULK) t->established--;
+    close_slot(t, s);
+}
+
+static void *loadgen_thread_main(void *arg) {
+    struct loadgen_thread *t = arg;
+    struct pollfd *fds = calloc((size_t)t->nslots, sizeof(struct pollfd));
+    int *index = calloc((size_t)t->nslots, sizeof(int));
+
+    t->ctx = t->backend->ctx_new();
+    if (!fds || !index || !t->ctx) {
+        fprintf(stderr, "Cannot set up load generator thread\n");
+        t->aborted = 1;
+        goto done;
+    }
+
+    while (now_ns() < t->end) {
+        int n = 0;
+        for (int i = 0; i < t->nslots; i++) {
+            struct slot *s = &t->slots[i];
+            if (s->state == SLOT_IDLE) slot_step(t, s);
+            if (s->fd >= 0 && s->events) {
+                fds[n].fd = s->fd;
+                fds[n].events = s->events;
+                fds[n].revents = 0;
+                index[n++] = i;
+            }
+        }
+        if (t->errors >= MIN_ERRORS_TO_ABORT && t->errors > t->handshakes + (long)(t->bytes / t->opts->message_size)) {
+            t->aborted = 1;
+            break;
+        }
+        if (poll(fds, (nfds_t)n, 100) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (fds[i].revents) slot_step(t, &t->slots[index[i]]);
+        }
+    }
+
+done:
+    for (int i = 0; i < t->nslots; i++) {
+        close_slot(t, &t->slots[i]);
+        if (t->slots[i].session) t->backend->session_free(t->slots[i].session);
+        t->slots[i].session = NULL;
+    }
+    if (t->ctx) t->backend->ctx_free(t->ctx);
+    t->ctx = NULL;
+    free(fds);
+    free(index);
+    return NULL;
+}
+
+/* Runs one phase on all threads and folds their results into total. */
+static int run_phase(const struct tls_loadgen_backend *backend, const struct options *opts,
+                     enum phase phase, struct loadgen_thread *threads, struct loadgen_thread *total) {
+    int started = 0;
+    int ret = 0;
+    uint64_t end = now_ns() + (uint64_t)(opts->seconds * 1e9);
+
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < opts->threads; i++) {
+        struct loadgen_thread *t = &threads[i];
+        struct slot *slots = t->slots;
+        unsigned char *out = t->out, *in = t->in;
+        int nslots = t->nslots;
+
+        memset(t, 0, sizeof(*t));
+        t->slots = slots;
+        t->nslots = nslots;
+        t->out = out;
+        t->in = in;
+        t->backend = backend;
+        t->opts = opts;
+        t->phase = phase;
+        t->end = end;
+        for (int j = 0; j < nslots; j++) {
+            memset(&slots[j], 0, sizeof(slots[j]));
+            slots[j].fd = -1;
+        }
+    }
+    for (; started < opts->threads; started++) {
+        if (pthread_create(&threads[started].thread, NULL, loadgen_thread_main, &threads[started]) != 0) {
+            fprintf(stderr, "Cannot start load generator threads\n");
+            ret = -1;
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        struct loadgen_thread *t = &threads[i];
+        pthread_join(t->thread, NULL);
+        if (t->aborted) ret = -1;
+        total->handshakes += t->handshakes;
+        total->resumed += t->resumed;
+        total->errors += t->errors;
+        total->bytes += t->bytes;
+        hist_merge(&total->hist, &t->hist);
+        /* Each thread starts measuring bulk traffic once all of its
+         * connections are up, so rates are summed per thread. */
+        if (t->measure_start && t->measure_start < t->end) {
+            total->bytes_per_second += (double)t->bytes / ((double)(t->end - t->measure_start) / 1e9);
+        }
+    }
+    if (ret != 0) fprintf(stderr, "Stopped after %ld connections and %ld errors\n", total->handshakes, total->errors);
+    return ret;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: tls_echo_client -l [-c connections] [-t threads] [-d seconds] [-s message_size] <hostname> <port>\n");
+    fprintf(stderr, "  -c connections  concurrent connections (default 64)\n");
+    fprintf(stderr, "  -t threads      threads sharing the connections (default 4)\n");
+    fprintf(stderr, "  -d seconds      duration of each phase (default 5)\n");
+    fprintf(stderr, "  -s size         bytes per echoed message in the bulk phase (default 16384)\n");
+}
+
+int tls_loadgen_main(const struct tls_loadgen_backend *backend, int argc, char **argv) {
+    struct options opts;
+    struct addrinfo hints;
+    struct loadgen_thread *threads = NULL;
+    struct loadgen_thread *total = NULL;
+    int ret = 1;
+    int opt;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.connections = 64;
+    opts.threads = 4;
+    opts.seconds = 5;
+    opts.message_size = 16384;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "c:t:d:s:")) != -1) {
+        switch (opt) {
+        case 'c':
+            opts.connections = atoi(optarg);
+            break;
+        case 't':
+            opts.threads = atoi(optarg);
+            break;
+        case 'd':
+            opts.seconds = atof(optarg);
+            break;
+        case 's':
+            opts.message_size = (size_t)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (argc - optind != 2 || opts.connections < 1 || opts.connections > MAX_CONNECTIONS ||
+        opts.threads < 1 || opts.threads > MAX_THREADS || opts.seconds <= 0 || opts.message_size < 1) {
+        usage();
+        return 1;
+    }
+    if (opts.threads > opts.connections) opts.threads = opts.connections;
+    opts.host = argv[optind];
+    opts.port = argv[optind + 1];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(opts.host, opts.port, &hints, &opts.addr);
+    if (err != 0) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", opts.host, gai_strerror(err));
+        return 1;
+    }
+
+    threads = calloc((size_t)opts.threads, sizeof(*threads));
+    total = calloc(1, sizeof(*total));
+    if (!threads || !total) goto cleanup;
+    for (int i = 0; i < opts.threads; i++) {
+        /* Spread the remainder so thread counts differ by at most one. */
+        threads[i].nslots = opts.connections / opts.threads + (i < opts.connections % opts.threads);
+        threads[i].slots = calloc((size_t)threads[i].nslots, sizeof(struct slot));
+        threads[i].out = malloc(opts.message_size > PING_SIZE ? opts.message_size : PING_SIZE);
+        threads[i].in = malloc(READ_SIZE);
+        if (!threads[i].slots || !threads[i].out || !threads[i].in) goto cleanup;
+        for (size_t j = 0; j < opts.message_size || j < PING_SIZE; j++) {
+            threads[i].out[j] = (unsigned char)j;
+        }
+    }
+
+    printf("Backend:            %s\n", backend->name);
+    printf("Connections:        %d over %d threads, %.1f s per phase\n", opts.connections, opts.threads, opts.seconds);
+    fflush(stdout);
+
+    long errors = 0;
+    if (run_phase(backend, &opts, PHASE_FULL, threads, total) != 0) goto cleanup;
+    errors += total->errors;
+    printf("Full handshakes:    %.1f/s\n", total->handshakes / opts.seconds);
+    fflush(stdout);
+
+    if (run_phase(backend, &opts, PHASE_RESUMED, threads, total) != 0) goto cleanup;
+    errors += total->errors;
+    if (backend->resumed) {
+        printf("Resumed handshakes: %.1f/s (%.1f%% resumed)\n", total->handshakes / opts.seconds,
+               total->handshakes ? 100.0 * total->resumed / total->handshakes : 0.0);
+    } else {
+        printf("Resumed handshakes: %.1f/s (resumption not reported by %s)\n", total->handshakes / opts.seconds,
+               backend->name);
+    }
+    fflush(stdout);
+
+    if (run_phase(backend, &opts, PHASE_BULK, threads, total) != 0) goto cleanup;
+    errors += total->errors;
+    if (total->hist.total == 0) {
+        printf("Bulk throughput:    no messages echoed\n");
+    } else {
+        printf("Bulk throughput:    %.1f MB/s echoed in %zu-byte messages\n", total->bytes_per_second / 1e6, opts.message_size);
+        printf("Bulk round trip:    p50 %.0f us, p99 %.0f us, p999 %.0f us\n",
+               hist_percentile(&total->hist, 0.50) / 1e3,
+               hist_percentile(&total->hist, 0.99) / 1e3,
+               hist_percentile(&total->hist, 0.999) / 1e3);
+    }
+    printf("Errors:             %ld\n", errors);
+    ret = 0;
+
+cleanup:
+    if (ret != 0) fprintf(stderr, "Load generator failed\n");
+    for (int i = 0; threads && i < opts.threads; i++) {
+        free(threads[i].slots);
+        free(threads[i].out);
+        free(threads[i].in);
+    }
+    free(threads);
+    free(total);
+    freeaddrinfo(opts.addr);
+    return ret;
+}
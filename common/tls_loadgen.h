@@ -0,0 +1,45 @@
+#ifndef TLS_LOADGEN_H
+#define TLS_LOADGEN_H
+
+#include <stddef.h>
+
+/* Results of the backend I/O calls besides a byte count. */
+#define TLS_LOADGEN_WANT_READ  -1
+#define TLS_LOADGEN_WANT_WRITE -2
+#define TLS_LOADGEN_CLOSED     -3
+#define TLS_LOADGEN_ERROR      -4
+
+/*
+ * A TLS library as seen by the load generator. The generator owns the
+ * sockets, which are non-blocking, and polls them; the backend runs TLS on
+ * a connected descriptor and maps its library's "would block" results to
+ * TLS_LOADGEN_WANT_READ/WANT_WRITE.
+ *
+ * ctx_new is called once per load generator thread, so a context never
+ * needs to be thread-safe. conn_free must not close the descriptor.
+ */
+struct tls_loadgen_backend {
+    const char *name;
+    void *(*ctx_new)(void);
+    void (*ctx_free)(void *ctx);
+    /* session is NULL or a value returned by session_get */
+    void *(*conn_new)(void *ctx, int fd, const char *host, void *session);
+    void (*conn_free)(void *conn);
+    /* 0 once the handshake is complete */
+    int (*handshake)(void *conn);
+    /* > 0 bytes transferred */
+    int (*read)(void *conn, unsigned char *buf, size_t len);
+    int (*write)(void *conn, const unsigned char *buf, size_t len);
+    /* 1 if the handshake resumed a session; NULL if the library cannot tell */
+    int (*resumed)(void *conn);
+    void *(*session_get)(void *conn);
+    void (*session_free)(void *session);
+};
+
+/*
+ * Runs the load generator with argv[0] = "-l" followed by its options and
+ * <host> <port>, and prints the results. Returns the process exit status.
+ */
+int tls_loadgen_main(const struct tls_loadgen_backend *backend, int argc, char **argv);
+
+#endif
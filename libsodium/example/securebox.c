@@ -1,10 +1,58 @@
+#define _FILE_OFFSET_BITS 64
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <sodium.h>
 
 #define MESSAGE_LEN 1024
-#define CHUNK_SIZE 4096
+
+/* All formats start with magic "SBOX" | version | ... and keep the chunk
+ * size as u32 LE at offset 8.
+ *
+ * v1: magic | 1 | 3 reserved | chunk size | secretstream header | chunks
+ *   A crypto_secretstream_xchacha20poly1305 stream; the last chunk is tagged
+ *   TAG_FINAL. Sequential by construction, so only decryption is kept.
+ *
+ * v2: magic | 2 | alg | 2 reserved | chunk size | 16 byte salt | chunks
+ *   Chunks are sealed independently with the AEAD named by alg
+ *   (XChaCha20-Poly1305, or AES-256-GCM when the CPU has AES instructions)
+ *   under a per-file subkey, BLAKE2b(key = master key, message = header).
+ *   The nonce is the chunk index, so chunks can be processed in any order but cannot be
+ *   reordered in the file; the additional data is one byte that is 1 only on
+ *   the last chunk, which catches truncation at a chunk boundary.
+ *
+ * v3: v2 followed by a trailer sealed under nonce index UINT64_MAX with
+ *   additional data 2, holding the plaintext length and chunk count (u64 LE
+ *   each). Decryption checks the trailer first, which also fixes the layout
+ *   of the file, so any chunk can be located and opened on its own. */
+#define SBOX_MAGIC "SBOX"
+#define SBOX_PREFIX_LEN 12
+#define SBOX_V1_HEADER_LEN (SBOX_PREFIX_LEN + crypto_secretstream_xchacha20poly1305_HEADERBYTES)
+#define SBOX_V2_HEADER_LEN (SBOX_PREFIX_LEN + 16)
+#define SBOX_VERSION 3
+#define SBOX_ALG_XCHACHA20POLY1305 1
+#define SBOX_ALG_AES256GCM 2
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define MAX_CHUNK_SIZE (4 * 1024 * 1024)
+#define DEFAULT_CHUNK_SIZE (1024 * 1024)
+#define STREAM_ABYTES crypto_secretstream_xchacha20poly1305_ABYTES
+/* Both AEADs use 32 byte keys and 16 byte tags. */
+#define CHUNK_ABYTES crypto_aead_xchacha20poly1305_ietf_ABYTES
+#define FILE_KEYBYTES crypto_aead_xchacha20poly1305_ietf_KEYBYTES
+#define MAX_JOBS 64
+#define TRAILER_INDEX UINT64_MAX
+#define TRAILER_LEN (16 + CHUNK_ABYTES)
+#define AD_CHUNK 0
+#define AD_LAST_CHUNK 1
+#define AD_TRAILER 2
+#define BATCH_LINE_MAX 8192
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
 
 void print_hex(const unsigned char *data, size_t len) {
   for (size_t i = 0; i < len; i++) {
@@ -21,108 +69,827 @@ void generate_key(void) {
   print_hex(key, crypto_secretbox_KEYBYTES);
 }
 
-int hex_to_bytes(const char *hex_str, unsigned char *bytes, size_t bytes_len) {
-  if (strlen(hex_str) != bytes_len * 2) {
-    return -1;
-  }
+/* The key is either 64 hex digits or @path to a file holding the 32 raw
+ * key bytes. */
+static int load_key(const char *arg, unsigned char *key) {
+  size_t key_len = 0;
+  const char *end = arg;
 
-  for (size_t i = 0; i < bytes_len; i++) {
-    int value;
-    if (sscanf(hex_str + i * 2, "%02x", &value) != 1) {
+  if (arg[0] == '@') {
+    FILE *fp = fopen(arg + 1, "rb");
+    if (fp == NULL) {
+      fprintf(stderr, "Error: Cannot open key file\n");
       return -1;
     }
-    bytes[i] = (unsigned char)value;
+    key_len = fread(key, 1, crypto_secretbox_KEYBYTES, fp);
+    int extra = fgetc(fp) != EOF;
+    fclose(fp);
+    if (key_len != crypto_secretbox_KEYBYTES || extra) {
+      sodium_memzero(key, crypto_secretbox_KEYBYTES);
+      fprintf(stderr, "Error: Key file must hold exactly %d bytes\n", crypto_secretbox_KEYBYTES);
+      return -1;
+    }
+    return 0;
   }
-  return 0;
-}
 
-int encrypt_file(const char *key_hex, const char *input_file, const char *output_file) {
-  unsigned char key[crypto_secretbox_KEYBYTES];
-  unsigned char nonce[crypto_secretbox_NONCEBYTES];
-  unsigned char buf_in[CHUNK_SIZE];
-  unsigned char buf_out[CHUNK_SIZE + crypto_secretbox_MACBYTES];
-  FILE *fp_in, *fp_out;
-
-  if (hex_to_bytes(key_hex, key, crypto_secretbox_KEYBYTES) != 0) {
+  if (sodium_hex2bin(key, crypto_secretbox_KEYBYTES, arg, strlen(arg), NULL, &key_len, &end) != 0 ||
+      key_len != crypto_secretbox_KEYBYTES || *end != '\0') {
+    sodium_memzero(key, crypto_secretbox_KEYBYTES);
     fprintf(stderr, "Error: Invalid key format\n");
     return -1;
   }
+  return 0;
+}
+
+static void put_u32le(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  p[3] = (unsigned char)(v >> 24);
+}
 
-  randombytes_buf(nonce, sizeof nonce);
+static uint32_t get_u32le(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
 
-  if ((fp_in = fopen(input_file, "rb")) == NULL) {
+static int open_files(const char *input_file, const char *output_file, FILE **fp_in, FILE **fp_out) {
+  if ((*fp_in = fopen(input_file, "rb")) == NULL) {
     fprintf(stderr, "Error: Cannot open input file\n");
     return -1;
   }
 
-  if ((fp_out = fopen(output_file, "wb")) == NULL) {
-    fclose(fp_in);
+  if ((*fp_out = fopen(output_file, "wb")) == NULL) {
+    fclose(*fp_in);
     fprintf(stderr, "Error: Cannot create output file\n");
     return -1;
   }
+  return 0;
+}
+
+static int close_files(FILE *fp_in, FILE *fp_out, int result) {
+  fclose(fp_in);
+  if (fclose(fp_out) != 0 && result == 0) {
+    fprintf(stderr, "Error: Cannot write output file\n");
+    result = -1;
+  }
+  return result;
+}
+
+enum slot_state { SLOT_FREE, SLOT_READ, SLOT_DONE };
+
+struct chunk_slot {
+  unsigned char *in;
+  unsigned char *out;
+  size_t in_len;
+  size_t out_len;
+  uint64_t index;
+  int last;
+  enum slot_state state;
+};
+
+/* Per-file key material. For AES-256-GCM the expanded key schedule is
+ * computed once and shared read-only by all workers. */
+struct file_cipher {
+  crypto_aead_aes256gcm_state aes;
+  unsigned char key[FILE_KEYBYTES];
+  int alg;
+};
+
+/* Chunk i always uses slot i % nslots. The reader fills a slot once the
+ * writer has released it, any worker may seal or open it, and the writer
+ * drains slots strictly in index order, so memory stays at nslots chunks. */
+
+struct pipeline {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct chunk_slot *slots;
+  size_t nslots;
+  uint64_t read_count;
+  uint64_t next_work;
+  uint64_t written;
+  uint64_t total;
+  uint64_t limit;
+  int eof;
+  int failed;
+  int decrypt;
+  size_t read_size;
+  struct file_cipher cipher;
+  FILE *fp_in;
+  FILE *fp_out;
+};
+
+static void put_u64le(unsigned char *p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static uint64_t get_u64le(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = v << 8 | p[i];
+  }
+  return v;
+}
+
+/* Nonces are the record index in little endian, zero padded to the nonce
+ * size of the algorithm (24 bytes for XChaCha20, 12 for AES-GCM). */
+static void seal_record(const struct file_cipher *cipher, uint64_t index, unsigned char ad,
+                        unsigned char *out, size_t *out_len, const unsigned char *in, size_t in_len) {
+  unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES] = { 0 };
+  unsigned long long len;
+
+  put_u64le(nonce, index);
+  if (cipher->alg == SBOX_ALG_AES256GCM) {
+    crypto_aead_aes256gcm_encrypt_afternm(out, &len, in, in_len, &ad, 1, NULL, nonce, &cipher->aes);
+  } else {
+    crypto_aead_xchacha20poly1305_ietf_encrypt(out, &len, in, in_len, &ad, 1, NULL, nonce, cipher->key);
+  }
+  *out_len = (size_t)len;
+}
+
+static int open_record(const struct file_cipher *cipher, uint64_t index, unsigned char ad,
+                       unsigned char *out, size_t *out_len, const unsigned char *in, size_t in_len) {
+  unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES] = { 0 };
+  unsigned long long len;
+  int rc;
+
+  if (in_len < CHUNK_ABYTES) {
+    return -1;
+  }
+  put_u64le(nonce, index);
+  if (cipher->alg == SBOX_ALG_AES256GCM) {
+    rc = crypto_aead_aes256gcm_decrypt_afternm(out, &len, NULL, in, in_len, &ad, 1, nonce, &cipher->aes);
+  } else {
+    rc = crypto_aead_xchacha20poly1305_ietf_decrypt(out, &len, NULL, in, in_len, &ad, 1, nonce, cipher->key);
+  }
+  if (rc != 0) {
+    return -1;
+  }
+  *out_len = (size_t)len;
+  return 0;
+}
+
+static int process_chunk(const struct pipeline *p, struct chunk_slot *slot) {
+  unsigned char ad = slot->last ? AD_LAST_CHUNK : AD_CHUNK;
+
+  if (!p->decrypt) {
+    seal_record(&p->cipher, slot->index, ad, slot->out, &slot->out_len, slot->in, slot->in_len);
+    return 0;
+  }
+  return open_record(&p->cipher, slot->index, ad, slot->out, &slot->out_len, slot->in, slot->in_len);
+}
+
+static void pipeline_fail(struct pipeline *p, const char *message) {
+  pthread_mutex_lock(&p->lock);
+  if (!p->failed) {
+    fprintf(stderr, "Error: %s\n", message);
+    p->failed = 1;
+  }
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+}
+
+static void *crypto_worker(void *arg) {
+  struct pipeline *p = arg;
 
-  fwrite(nonce, 1, sizeof nonce, fp_out);
+  pthread_mutex_lock(&p->lock);
+  while (1) {
+    while (!p->failed && !p->eof && p->next_work >= p->read_count) {
+      pthread_cond_wait(&p->cond, &p->lock);
+    }
+    if (p->failed || p->next_work >= p->read_count) {
+      break;
+    }
+    struct chunk_slot *slot = &p->slots[p->next_work++ % p->nslots];
+    pthread_mutex_unlock(&p->lock);
 
-  while (!feof(fp_in)) {
-    size_t bytes_read = fread(buf_in, 1, CHUNK_SIZE, fp_in);
-    if (bytes_read > 0) {
-      unsigned long long cipher_len;
-      crypto_secretbox_easy(buf_out, buf_in, bytes_read, nonce, key);
-      fwrite(buf_out, 1, bytes_read + crypto_secretbox_MACBYTES, fp_out);
+    if (process_chunk(p, slot) != 0) {
+      pipeline_fail(p, "Decryption failed");
     }
+
+    pthread_mutex_lock(&p->lock);
+    slot->state = SLOT_DONE;
+    pthread_cond_broadcast(&p->cond);
   }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
 
-  fclose(fp_in);
-  fclose(fp_out);
+static void *writer_thread(void *arg) {
+  struct pipeline *p = arg;
+  int ok = 1;
+
+  pthread_mutex_lock(&p->lock);
+  while (ok) {
+    struct chunk_slot *slot = &p->slots[p->written % p->nslots];
+    while (!p->failed && !(p->eof && p->written == p->read_count) &&
+           !(p->written < p->read_count && slot->state == SLOT_DONE)) {
+      pthread_cond_wait(&p->cond, &p->lock);
+    }
+    if (p->failed || p->written == p->read_count) {
+      break;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    ok = fwrite(slot->out, 1, slot->out_len, p->fp_out) == slot->out_len;
+
+    pthread_mutex_lock(&p->lock);
+    p->total += p->decrypt ? slot->out_len : slot->in_len;
+    slot->state = SLOT_FREE;
+    p->written++;
+    pthread_cond_broadcast(&p->cond);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  if (!ok) {
+    pipeline_fail(p, "Cannot write output file");
+  }
+  return NULL;
+}
+
+/* Reads record i into slot. A record is the last one when it is short, ends
+ * at the limit, or nothing follows it. */
+static int fill_slot(struct pipeline *p, struct chunk_slot *slot, uint64_t i) {
+  size_t want = p->limit < p->read_size ? (size_t)p->limit : p->read_size;
+  size_t n = fread(slot->in, 1, want, p->fp_in);
+  if (ferror(p->fp_in)) {
+    return -1;
+  }
+  p->limit -= n;
+  int last = n < p->read_size || p->limit == 0;
+  if (!last) {
+    int c = fgetc(p->fp_in);
+    last = c == EOF;
+    if (!last) {
+      ungetc(c, p->fp_in);
+    }
+  }
+  slot->in_len = n;
+  slot->index = i;
+  slot->last = last;
   return 0;
 }
 
-int decrypt_file(const char *key_hex, const char *input_file, const char *output_file) {
-  unsigned char key[crypto_secretbox_KEYBYTES];
-  unsigned char nonce[crypto_secretbox_NONCEBYTES];
-  unsigned char buf_in[CHUNK_SIZE + crypto_secretbox_MACBYTES];
-  unsigned char buf_out[CHUNK_SIZE];
+/* Reads records into the slot ring on the calling thread while the workers
+ * and the writer run. */
+static void read_chunks(struct pipeline *p) {
+  for (uint64_t i = 0;; i++) {
+    struct chunk_slot *slot = &p->slots[i % p->nslots];
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->failed && slot->state != SLOT_FREE) {
+      pthread_cond_wait(&p->cond, &p->lock);
+    }
+    int failed = p->failed;
+    pthread_mutex_unlock(&p->lock);
+    if (failed) {
+      return;
+    }
+
+    if (fill_slot(p, slot, i) != 0) {
+      pipeline_fail(p, "Cannot read input file");
+      return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    slot->state = SLOT_READ;
+    p->read_count++;
+    p->eof = slot->last;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    if (slot->last) {
+      return;
+    }
+  }
+}
+
+static int run_pipeline(struct pipeline *p, size_t chunk_size, int jobs) {
+  p->nslots = (size_t)jobs * 2 + 2;
+  p->slots = calloc(p->nslots, sizeof(struct chunk_slot));
+  int result = p->slots ? 0 : -1;
+  for (size_t i = 0; result == 0 && i < p->nslots; i++) {
+    p->slots[i].in = malloc(chunk_size + CHUNK_ABYTES);
+    p->slots[i].out = malloc(chunk_size + CHUNK_ABYTES);
+    if (!p->slots[i].in || !p->slots[i].out) {
+      result = -1;
+    }
+  }
+  if (result != 0) {
+    fprintf(stderr, "Error: Out of memory\n");
+  }
+
+  pthread_t workers[MAX_JOBS];
+  pthread_t writer;
+  int started = 0;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  int writer_started = result == 0 && pthread_create(&writer, NULL, writer_thread, p) == 0;
+  for (; writer_started && started < jobs; started++) {
+    if (pthread_create(&workers[started], NULL, crypto_worker, p) != 0) {
+      break;
+    }
+  }
+
+  if (writer_started && started > 0) {
+    read_chunks(p);
+  } else if (result == 0) {
+    pipeline_fail(p, "Cannot start worker threads");
+  }
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  if (writer_started) {
+    pthread_join(writer, NULL);
+  }
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->lock);
+
+  if (p->failed) {
+    result = -1;
+  }
+  for (size_t i = 0; p->slots && i < p->nslots; i++) {
+    free(p->slots[i].in);
+    free(p->slots[i].out);
+  }
+  free(p->slots);
+  return result;
+}
+
+/* Single-threaded counterpart of run_pipeline for batch workers, which
+ * already run one file per thread and reuse one slot across files. */
+static int run_serial(struct pipeline *p, struct chunk_slot *slot) {
+  for (uint64_t i = 0;; i++) {
+    if (fill_slot(p, slot, i) != 0) {
+      fprintf(stderr, "Error: Cannot read input file\n");
+      return -1;
+    }
+    if (process_chunk(p, slot) != 0) {
+      fprintf(stderr, "Error: Decryption failed\n");
+      return -1;
+    }
+    if (fwrite(slot->out, 1, slot->out_len, p->fp_out) != slot->out_len) {
+      fprintf(stderr, "Error: Cannot write output file\n");
+      return -1;
+    }
+    p->total += p->decrypt ? slot->out_len : slot->in_len;
+    p->read_count++;
+    if (slot->last) {
+      return 0;
+    }
+  }
+}
+
+static int init_cipher(struct file_cipher *cipher, const unsigned char *header, const unsigned char *key) {
+  cipher->alg = header[5];
+  if (cipher->alg == SBOX_ALG_AES256GCM && !crypto_aead_aes256gcm_is_available()) {
+    fprintf(stderr, "Error: File uses AES-256-GCM, which this CPU does not support\n");
+    return -1;
+  }
+  crypto_generichash(cipher->key, sizeof cipher->key, header, SBOX_V2_HEADER_LEN, key, crypto_secretbox_KEYBYTES);
+  if (cipher->alg == SBOX_ALG_AES256GCM) {
+    crypto_aead_aes256gcm_beforenm(&cipher->aes, cipher->key);
+  }
+  return 0;
+}
+
+static void wipe_cipher(struct file_cipher *cipher) {
+  sodium_memzero(cipher, sizeof *cipher);
+}
+
+/* Encrypts fp_in to fp_out with jobs pipeline threads, or on the calling
+ * thread with the buffers of serial when it is not NULL. */
+static int encrypt_stream(FILE *fp_in, FILE *fp_out, const unsigned char *key, size_t chunk_size,
+                          int jobs, int alg, struct chunk_slot *serial) {
+  unsigned char header[SBOX_V2_HEADER_LEN];
+  struct pipeline p;
+
+  memset(header, 0, SBOX_PREFIX_LEN);
+  memcpy(header, SBOX_MAGIC, 4);
+  header[4] = SBOX_VERSION;
+  header[5] = (unsigned char)alg;
+  put_u32le(header + 8, (uint32_t)chunk_size);
+  randombytes_buf(header + SBOX_PREFIX_LEN, SBOX_V2_HEADER_LEN - SBOX_PREFIX_LEN);
+
+  memset(&p, 0, sizeof p);
+  init_cipher(&p.cipher, header, key);
+  p.decrypt = 0;
+  p.read_size = chunk_size;
+  p.limit = UINT64_MAX;
+  p.fp_in = fp_in;
+  p.fp_out = fp_out;
+
+  int result = 0;
+  if (fwrite(header, 1, sizeof header, fp_out) != sizeof header) {
+    fprintf(stderr, "Error: Cannot write output file\n");
+    result = -1;
+  }
+  if (result == 0) {
+    result = serial ? run_serial(&p, serial) : run_pipeline(&p, chunk_size, jobs);
+  }
+  if (result == 0) {
+    unsigned char totals[16];
+    unsigned char trailer[TRAILER_LEN];
+    size_t trailer_len;
+    put_u64le(totals, p.total);
+    put_u64le(totals + 8, p.read_count);
+    seal_record(&p.cipher, TRAILER_INDEX, AD_TRAILER, trailer, &trailer_len, totals, sizeof totals);
+    if (fwrite(trailer, 1, trailer_len, fp_out) != trailer_len) {
+      fprintf(stderr, "Error: Cannot write output file\n");
+      result = -1;
+    }
+  }
+
+  wipe_cipher(&p.cipher);
+  return result;
+}
+
+int encrypt_file(const unsigned char *key, const char *input_file, const char *output_file,
+                 size_t chunk_size, int jobs, int alg) {
   FILE *fp_in, *fp_out;
 
-  if (hex_to_bytes(key_hex, key, crypto_secretbox_KEYBYTES) != 0) {
-    fprintf(stderr, "Error: Invalid key format\n");
+  if (open_files(input_file, output_file, &fp_in, &fp_out) != 0) {
     return -1;
   }
+  int result = encrypt_stream(fp_in, fp_out, key, chunk_size, jobs, alg, NULL);
+  return close_files(fp_in, fp_out, result);
+}
 
-  if ((fp_in = fopen(input_file, "rb")) == NULL) {
-    fprintf(stderr, "Error: Cannot open input file\n");
+static int decrypt_v1(FILE *fp_in, FILE *fp_out, const unsigned char *key,
+                      const unsigned char *header, size_t chunk_size) {
+  crypto_secretstream_xchacha20poly1305_state state;
+
+  if (crypto_secretstream_xchacha20poly1305_init_pull(&state, header + SBOX_PREFIX_LEN, key) != 0) {
+    fprintf(stderr, "Error: Invalid encrypted file format\n");
     return -1;
   }
 
-  if ((fp_out = fopen(output_file, "wb")) == NULL) {
-    fclose(fp_in);
-    fprintf(stderr, "Error: Cannot create output file\n");
+  unsigned char *buf_in = malloc(chunk_size + STREAM_ABYTES);
+  unsigned char *buf_out = malloc(chunk_size);
+  if (!buf_in || !buf_out) {
+    free(buf_in);
+    free(buf_out);
+    fprintf(stderr, "Error: Out of memory\n");
     return -1;
   }
 
-  if (fread(nonce, 1, sizeof nonce, fp_in) != sizeof nonce) {
-    fclose(fp_in);
-    fclose(fp_out);
+  int result = 0;
+  unsigned char tag = 0;
+  while (result == 0 && tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL) {
+    size_t bytes_read = fread(buf_in, 1, chunk_size + STREAM_ABYTES, fp_in);
+    unsigned long long out_len;
+    if (bytes_read < STREAM_ABYTES ||
+        crypto_secretstream_xchacha20poly1305_pull(&state, buf_out, &out_len, &tag, buf_in, bytes_read,
+                                                   header, SBOX_PREFIX_LEN) != 0) {
+      fprintf(stderr, "Error: Decryption failed\n");
+      result = -1;
+    } else if (tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL && bytes_read < chunk_size + STREAM_ABYTES) {
+      fprintf(stderr, "Error: Encrypted file is truncated\n");
+      result = -1;
+    } else if (fwrite(buf_out, 1, (size_t)out_len, fp_out) != out_len) {
+      fprintf(stderr, "Error: Cannot write output file\n");
+      result = -1;
+    }
+  }
+  if (result == 0 && fgetc(fp_in) != EOF) {
+    fprintf(stderr, "Error: Unexpected data after end of stream\n");
+    result = -1;
+  }
+
+  sodium_memzero(&state, sizeof state);
+  free(buf_in);
+  free(buf_out);
+  return result;
+}
+
+/* Reads and checks the header; returns the format version or -1. */
+static int read_header(FILE *fp_in, unsigned char *header, size_t *header_len, size_t *chunk_size) {
+  int version = 0;
+  *chunk_size = 0;
+  if (fread(header, 1, SBOX_PREFIX_LEN, fp_in) == SBOX_PREFIX_LEN && memcmp(header, SBOX_MAGIC, 4) == 0) {
+    version = header[4];
+    *chunk_size = get_u32le(header + 8);
+  }
+  *header_len = version == 1 ? SBOX_V1_HEADER_LEN : SBOX_V2_HEADER_LEN;
+  if ((version != 1 && !((version == 2 || version == 3) &&
+                          (header[5] == SBOX_ALG_XCHACHA20POLY1305 || header[5] == SBOX_ALG_AES256GCM))) ||
+      *chunk_size < MIN_CHUNK_SIZE || *chunk_size > MAX_CHUNK_SIZE ||
+      fread(header + SBOX_PREFIX_LEN, 1, *header_len - SBOX_PREFIX_LEN, fp_in) != *header_len - SBOX_PREFIX_LEN) {
     fprintf(stderr, "Error: Invalid encrypted file format\n");
     return -1;
   }
+  return version;
+}
+
+/* Opens the v3 trailer and checks that the chunk area between header and
+ * trailer has exactly the size its totals imply. Leaves the file positioned
+ * at the first chunk. */
+static int read_trailer(FILE *fp_in, const struct file_cipher *cipher, size_t header_len, size_t chunk_size,
+                        uint64_t *total, uint64_t *count, uint64_t *data_len) {
+  unsigned char trailer[TRAILER_LEN];
+  unsigned char totals[16];
+  size_t totals_len;
+
+  if (fseeko(fp_in, 0, SEEK_END) != 0) {
+    fprintf(stderr, "Error: Cannot seek in input file\n");
+    return -1;
+  }
+  int64_t file_size = (int64_t)ftello(fp_in);
+  if (file_size < (int64_t)(header_len + TRAILER_LEN) ||
+      fseeko(fp_in, file_size - TRAILER_LEN, SEEK_SET) != 0 ||
+      fread(trailer, 1, TRAILER_LEN, fp_in) != TRAILER_LEN ||
+      open_record(cipher, TRAILER_INDEX, AD_TRAILER, totals, &totals_len, trailer, TRAILER_LEN) != 0) {
+    fprintf(stderr, "Error: Decryption failed\n");
+    return -1;
+  }
+
+  *total = get_u64le(totals);
+  *count = get_u64le(totals + 8);
+  *data_len = (uint64_t)file_size - header_len - TRAILER_LEN;
+  uint64_t expected = *total == 0 ? 1 : (*total + chunk_size - 1) / chunk_size;
+  if (*count != expected || *data_len != *total + *count * CHUNK_ABYTES) {
+    fprintf(stderr, "Error: Encrypted file is truncated\n");
+    return -1;
+  }
+  if (fseeko(fp_in, (int64_t)header_len, SEEK_SET) != 0) {
+    fprintf(stderr, "Error: Cannot seek in input file\n");
+    return -1;
+  }
+  return 0;
+}
 
-  while (!feof(fp_in)) {
-    size_t bytes_read = fread(buf_in, 1, CHUNK_SIZE + crypto_secretbox_MACBYTES, fp_in);
-    if (bytes_read > crypto_secretbox_MACBYTES) {
-      if (crypto_secretbox_open_easy(buf_out, buf_in, bytes_read, nonce, key) != 0) {
-        fclose(fp_in);
-        fclose(fp_out);
-        fprintf(stderr, "Error: Decryption failed\n");
-        return -1;
+/* Decrypts fp_in to fp_out; jobs and serial as for encrypt_stream. A
+ * serial slot must hold MAX_CHUNK_SIZE + CHUNK_ABYTES bytes. */
+static int decrypt_stream(FILE *fp_in, FILE *fp_out, const unsigned char *key, int jobs,
+                          struct chunk_slot *serial) {
+  unsigned char header[SBOX_V1_HEADER_LEN];
+  size_t header_len, chunk_size;
+  int version = read_header(fp_in, header, &header_len, &chunk_size);
+  int result = version < 0 ? -1 : 0;
+  if (version == 1) {
+    result = decrypt_v1(fp_in, fp_out, key, header, chunk_size);
+  } else if (version > 1) {
+    struct pipeline p;
+    memset(&p, 0, sizeof p);
+    result = init_cipher(&p.cipher, header, key);
+    p.decrypt = 1;
+    p.read_size = chunk_size + CHUNK_ABYTES;
+    p.limit = UINT64_MAX;
+    p.fp_in = fp_in;
+    p.fp_out = fp_out;
+
+    uint64_t total, count;
+    if (result == 0 && version == 3) {
+      result = read_trailer(fp_in, &p.cipher, header_len, chunk_size, &total, &count, &p.limit);
+    }
+    if (result == 0) {
+      result = serial ? run_serial(&p, serial) : run_pipeline(&p, chunk_size, jobs);
+    }
+    wipe_cipher(&p.cipher);
+  }
+  return result;
+}
+
+int decrypt_file(const unsigned char *key, const char *input_file, const char *output_file, int jobs) {
+  FILE *fp_in, *fp_out;
+
+  if (open_files(input_file, output_file, &fp_in, &fp_out) != 0) {
+    return -1;
+  }
+  int result = decrypt_stream(fp_in, fp_out, key, jobs, NULL);
+  return close_files(fp_in, fp_out, result);
+}
+
+/* Decrypts only the chunks overlapping [offset, offset + length). */
+int decrypt_range(const unsigned char *key, const char *input_file, const char *output_file,
+                  uint64_t offset, uint64_t length) {
+  struct file_cipher cipher;
+  unsigned char header[SBOX_V1_HEADER_LEN];
+  FILE *fp_in, *fp_out;
+
+  if (open_files(input_file, output_file, &fp_in, &fp_out) != 0) {
+    return -1;
+  }
+
+  size_t header_len, chunk_size;
+  int version = read_header(fp_in, header, &header_len, &chunk_size);
+  if (version >= 0 && version < 3) {
+    fprintf(stderr, "Error: Range decryption needs a version 3 file\n");
+  }
+  if (version < 3) {
+    return close_files(fp_in, fp_out, -1);
+  }
+  int result = init_cipher(&cipher, header, key);
+
+  uint64_t total, count, data_len;
+  if (result == 0) {
+    result = read_trailer(fp_in, &cipher, header_len, chunk_size, &total, &count, &data_len);
+  }
+  if (result == 0 && (offset > total || length > total - offset)) {
+    fprintf(stderr, "Error: Range is outside the %llu byte plaintext\n", (unsigned long long)total);
+    result = -1;
+  }
+
+  unsigned char *buf_in = malloc(chunk_size + CHUNK_ABYTES);
+  unsigned char *buf_out = malloc(chunk_size);
+  if (result == 0 && (!buf_in || !buf_out)) {
+    fprintf(stderr, "Error: Out of memory\n");
+    result = -1;
+  }
+
+  uint64_t end = offset + length;
+  for (uint64_t i = offset / chunk_size; result == 0 && length > 0 && i <= (end - 1) / chunk_size; i++) {
+    uint64_t chunk_start = i * chunk_size;
+    size_t plain_len = total - chunk_start < chunk_size ? (size_t)(total - chunk_start) : chunk_size;
+    size_t record_len = plain_len + CHUNK_ABYTES;
+    size_t out_len;
+
+    if (fseeko(fp_in, (int64_t)(header_len + i * (chunk_size + CHUNK_ABYTES)), SEEK_SET) != 0 ||
+        fread(buf_in, 1, record_len, fp_in) != record_len) {
+      fprintf(stderr, "Error: Cannot read input file\n");
+      result = -1;
+    } else if (open_record(&cipher, i, i + 1 == count ? AD_LAST_CHUNK : AD_CHUNK,
+                           buf_out, &out_len, buf_in, record_len) != 0) {
+      fprintf(stderr, "Error: Decryption failed\n");
+      result = -1;
+    } else {
+      size_t from = offset > chunk_start ? (size_t)(offset - chunk_start) : 0;
+      size_t to = end - chunk_start < out_len ? (size_t)(end - chunk_start) : out_len;
+      if (fwrite(buf_out + from, 1, to - from, fp_out) != to - from) {
+        fprintf(stderr, "Error: Cannot write output file\n");
+        result = -1;
       }
-      fwrite(buf_out, 1, bytes_read - crypto_secretbox_MACBYTES, fp_out);
     }
   }
 
-  fclose(fp_in);
-  fclose(fp_out);
-  return 0;
+  wipe_cipher(&cipher);
+  free(buf_in);
+  free(buf_out);
+  return close_files(fp_in, fp_out, result);
+}
+
+/* Batch mode: workers take "input<TAB>output" lines from a shared manifest
+ * and process one file each at a time, on their own thread and with one
+ * chunk buffer pair reused for every file they handle. */
+struct batch {
+  pthread_mutex_t lock;
+  FILE *manifest;
+  const unsigned char *key;
+  size_t chunk_size;
+  int alg;
+  int decrypt;
+  unsigned long line_no;
+  unsigned long done;
+  unsigned long failed;
+  int out_of_memory;
+};
+
+/* Returns the next manifest entry, split in place into input and output,
+ * or 0 at the end of the manifest. Blank lines and lines starting with '#'
+ * are skipped; a line without a tab is split at its first space. */
+static int next_entry(struct batch *b, char *line, char **input, char **output) {
+  int found = 0;
+
+  pthread_mutex_lock(&b->lock);
+  while (!found && fgets(line, BATCH_LINE_MAX, b->manifest) != NULL) {
+    size_t len = strlen(line);
+    b->line_no++;
+    if (len == BATCH_LINE_MAX - 1 && line[len - 1] != '\n') {
+      int c;
+      while ((c = fgetc(b->manifest)) != EOF && c != '\n') {
+      }
+      fprintf(stderr, "Error: Manifest line %lu is too long\n", b->line_no);
+      b->failed++;
+      continue;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0 || line[0] == '#') {
+      continue;
+    }
+
+    char *sep = strchr(line, '\t');
+    if (sep == NULL) {
+      sep = strchr(line, ' ');
+    }
+    if (sep == NULL || sep == line || sep[1] == '\0') {
+      fprintf(stderr, "Error: Manifest line %lu needs an input and an output file\n", b->line_no);
+      b->failed++;
+      continue;
+    }
+    *sep = '\0';
+    *input = line;
+    *output = sep + 1;
+    found = 1;
+  }
+  if (!found && ferror(b->manifest)) {
+    fprintf(stderr, "Error: Cannot read manifest\n");
+    b->failed++;
+    clearerr(b->manifest);
+  }
+  pthread_mutex_unlock(&b->lock);
+  return found;
+}
+
+static void *batch_worker(void *arg) {
+  struct batch *b = arg;
+  size_t buf_size = (b->decrypt ? MAX_CHUNK_SIZE : b->chunk_size) + CHUNK_ABYTES;
+  struct chunk_slot slot;
+  char *line = malloc(BATCH_LINE_MAX);
+  char *input, *output;
+
+  memset(&slot, 0, sizeof slot);
+  slot.in = malloc(buf_size);
+  slot.out = malloc(buf_size);
+  if (!line || !slot.in || !slot.out) {
+    pthread_mutex_lock(&b->lock);
+    b->out_of_memory = 1;
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  while (line && slot.in && slot.out && next_entry(b, line, &input, &output)) {
+    FILE *fp_in, *fp_out;
+    int result = open_files(input, output, &fp_in, &fp_out);
+    if (result == 0) {
+      result = b->decrypt ? decrypt_stream(fp_in, fp_out, b->key, 1, &slot)
+                          : encrypt_stream(fp_in, fp_out, b->key, b->chunk_size, 1, b->alg, &slot);
+      result = close_files(fp_in, fp_out, result);
+    }
+
+    pthread_mutex_lock(&b->lock);
+    if (result != 0) {
+      fprintf(stderr, "Error: Failed to %s '%s'\n", b->decrypt ? "decrypt" : "encrypt", input);
+      b->failed++;
+    } else {
+      b->done++;
+    }
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  free(line);
+  free(slot.in);
+  free(slot.out);
+  return NULL;
+}
+
+/* Processes every entry of the manifest ("-" for stdin) with jobs workers.
+ * Failed entries are reported and skipped; the result is -1 if any failed. */
+int batch_files(const unsigned char *key, const char *manifest_file, int decrypt,
+                size_t chunk_size, int jobs, int alg) {
+  struct batch b;
+  pthread_t workers[MAX_JOBS];
+  int started = 0;
+
+  memset(&b, 0, sizeof b);
+  b.manifest = strcmp(manifest_file, "-") == 0 ? stdin : fopen(manifest_file, "r");
+  if (b.manifest == NULL) {
+    fprintf(stderr, "Error: Cannot open manifest\n");
+    return -1;
+  }
+  b.key = key;
+  b.chunk_size = chunk_size;
+  b.alg = alg;
+  b.decrypt = decrypt;
+  pthread_mutex_init(&b.lock, NULL);
+
+  for (; started < jobs; started++) {
+    if (pthread_create(&workers[started], NULL, batch_worker, &b) != 0) {
+      break;
+    }
+  }
+  if (started == 0) {
+    fprintf(stderr, "Error: Cannot start worker threads\n");
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  if (b.out_of_memory) {
+    fprintf(stderr, "Error: Out of memory\n");
+  }
+  pthread_mutex_destroy(&b.lock);
+  if (b.manifest != stdin) {
+    fclose(b.manifest);
+  }
+
+  printf("%s %lu files, %lu failed\n", decrypt ? "Decrypted" : "Encrypted", b.done, b.failed);
+  return started > 0 && !b.out_of_memory && b.failed == 0 ? 0 : -1;
+}
+
+static void print_usage(const char *prog) {
+  printf("Usage:\n");
+  printf("  Generate new key:   %s keygen\n", prog);
+  printf("  Encrypt file:       %s encrypt [-j threads] [-s chunk_kib] [-a cipher] <key> <input_file> <output_file>\n", prog);
+  printf("  Decrypt file:       %s decrypt [-j threads] <key> <input_file> <output_file>\n", prog);
+  printf("  Decrypt a range:    %s decrypt --range offset:length <key> <input_file> <output_file>\n", prog);
+  printf("  Encrypt many files: %s batch-encrypt [-j threads] [-s chunk_kib] [-a cipher] <key> <manifest>\n", prog);
+  printf("  Decrypt many files: %s batch-decrypt [-j threads] <key> <manifest>\n", prog);
+  printf("Key is 64 hex digits or @file holding the 32 raw key bytes\n");
+  printf("Manifest lines are \"input<TAB>output\"; use - to read them from stdin\n");
+  printf("Chunk size is %d to %d KiB (default %d)\n",
+         MIN_CHUNK_SIZE / 1024, MAX_CHUNK_SIZE / 1024, DEFAULT_CHUNK_SIZE / 1024);
+  printf("Cipher is auto, aes256gcm or xchacha20poly1305 (default auto: AES-256-GCM when the CPU supports it)\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -132,38 +899,110 @@ int main(int argc, char *argv[]) {
   }
 
   if (argc < 2) {
-    printf("Usage:\n");
-    printf("  Generate new key:   %s keygen\n", argv[0]);
-    printf("  Encrypt file:       %s encrypt <key> <input_file> <output_file>\n", argv[0]);
-    printf("  Decrypt file:       %s decrypt <key> <input_file> <output_file>\n", argv[0]);
+    print_usage(argv[0]);
     return 1;
   }
 
-  if (strcmp(argv[1], "keygen") == 0) {
-    generate_key();
-  }
-  else if (strcmp(argv[1], "encrypt") == 0) {
-    if (argc < 5) {
-      fprintf(stderr, "Error: Not enough arguments for encryption\n");
+  size_t chunk_size = DEFAULT_CHUNK_SIZE;
+  int jobs = 1;
+  const char *range = NULL;
+  const char *cipher = "auto";
+  int arg = 2;
+  while (arg < argc && argv[arg][0] == '-') {
+    if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+      chunk_size = (size_t)strtoul(argv[arg + 1], NULL, 10) * 1024;
+      arg += 2;
+    } else if (strcmp(argv[arg], "--range") == 0 && arg + 1 < argc) {
+      range = argv[arg + 1];
+      arg += 2;
+    } else if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc) {
+      cipher = argv[arg + 1];
+      arg += 2;
+    } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+      jobs = atoi(argv[arg + 1]);
+      arg += 2;
+    } else {
+      fprintf(stderr, "Error: Unknown option '%s'\n", argv[arg]);
       return 1;
     }
-    if (encrypt_file(argv[2], argv[3], argv[4]) == 0) {
-      printf("Encryption completed successfully\n");
-    }
   }
-  else if (strcmp(argv[1], "decrypt") == 0) {
-    if (argc < 5) {
-      fprintf(stderr, "Error: Not enough arguments for decryption\n");
+  if (chunk_size < MIN_CHUNK_SIZE || chunk_size > MAX_CHUNK_SIZE) {
+    fprintf(stderr, "Error: Chunk size must be between %d and %d KiB\n",
+            MIN_CHUNK_SIZE / 1024, MAX_CHUNK_SIZE / 1024);
+    return 1;
+  }
+  if (jobs < 1 || jobs > MAX_JOBS) {
+    fprintf(stderr, "Error: Thread count must be between 1 and %d\n", MAX_JOBS);
+    return 1;
+  }
+
+  int alg;
+  if (strcmp(cipher, "auto") == 0) {
+    alg = crypto_aead_aes256gcm_is_available() ? SBOX_ALG_AES256GCM : SBOX_ALG_XCHACHA20POLY1305;
+  } else if (strcmp(cipher, "aes256gcm") == 0) {
+    if (!crypto_aead_aes256gcm_is_available()) {
+      fprintf(stderr, "Error: AES-256-GCM is not supported on this CPU\n");
       return 1;
     }
-    if (decrypt_file(argv[2], argv[3], argv[4]) == 0) {
-      printf("Decryption completed successfully\n");
-    }
+    alg = SBOX_ALG_AES256GCM;
+  } else if (strcmp(cipher, "xchacha20poly1305") == 0) {
+    alg = SBOX_ALG_XCHACHA20POLY1305;
+  } else {
+    fprintf(stderr, "Error: Unknown cipher '%s'\n", cipher);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "keygen") == 0) {
+    generate_key();
+    return 0;
   }
-  else {
+
+  int batch = strcmp(argv[1], "batch-encrypt") == 0 || strcmp(argv[1], "batch-decrypt") == 0;
+  int decrypt = strcmp(argv[1], "decrypt") == 0 || strcmp(argv[1], "batch-decrypt") == 0;
+  if (!batch && !decrypt && strcmp(argv[1], "encrypt") != 0) {
     fprintf(stderr, "Error: Unknown command '%s'\n", argv[1]);
     return 1;
   }
+  if (argc - arg < (batch ? 2 : 3)) {
+    fprintf(stderr, "Error: Not enough arguments for %s\n", decrypt ? "decryption" : "encryption");
+    return 1;
+  }
+
+  uint64_t offset = 0, length = 0;
+  if (range) {
+    char *end;
+    offset = strtoull(range, &end, 10);
+    if (*end == ':') {
+      length = strtoull(end + 1, &end, 10);
+    }
+    if (!decrypt || batch || *end != '\0' || end == range) {
+      fprintf(stderr, "Error: Range must be offset:length and is only valid for decrypt\n");
+      return 1;
+    }
+  }
 
+  unsigned char key[crypto_secretbox_KEYBYTES];
+  if (load_key(argv[arg], key) != 0) {
+    return 1;
+  }
+
+  int result;
+  if (batch) {
+    result = batch_files(key, argv[arg + 1], decrypt, chunk_size, jobs, alg);
+  } else if (!decrypt) {
+    result = encrypt_file(key, argv[arg + 1], argv[arg + 2], chunk_size, jobs, alg);
+  } else if (range) {
+    result = decrypt_range(key, argv[arg + 1], argv[arg + 2], offset, length);
+  } else {
+    result = decrypt_file(key, argv[arg + 1], argv[arg + 2], jobs);
+  }
+  sodium_memzero(key, sizeof key);
+
+  if (result != 0) {
+    return 1;
+  }
+  if (!batch) {
+    printf("%s completed successfully\n", decrypt ? "Decryption" : "Encryption");
+  }
   return 0;
 }
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sodium.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define MAX_SIZE (16 * 1024 * 1024)
+#define MAX_THREADS 64
+#define MAX_BASELINE 256
+#define BUFFER_SLACK 64
+
+/* Set from the LIBSODIUM_PERF_PROFILE property of the library we link. */
+#ifndef SODIUM_BENCH_PROFILE
+#define SODIUM_BENCH_PROFILE "default"
+#endif
+
+static const size_t sizes[] = {
+  64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216,
+};
+
+/* Per-thread state; every thread hashes or seals its own buffers so runs
+ * measure the primitive, not cache line sharing. */
+struct bench_ctx {
+  crypto_aead_aes256gcm_state aes;
+  unsigned char key[32];
+  unsigned char nonce[crypto_secretbox_NONCEBYTES];
+  unsigned char *in;
+  unsigned char *out;
+};
+
+static void run_secretbox(struct bench_ctx *ctx, size_t len) {
+  crypto_secretbox_easy(ctx->out, ctx->in, len, ctx->nonce, ctx->key);
+}
+
+static void run_xchacha20poly1305(struct bench_ctx *ctx, size_t len) {
+  unsigned long long out_len;
+  crypto_aead_xchacha20poly1305_ietf_encrypt(ctx->out, &out_len, ctx->in, len, NULL, 0, NULL,
+                                             ctx->nonce, ctx->key);
+}
+
+static void run_aes256gcm(struct bench_ctx *ctx, size_t len) {
+  unsigned long long out_len;
+  crypto_aead_aes256gcm_encrypt_afternm(ctx->out, &out_len, ctx->in, len, NULL, 0, NULL,
+                                        ctx->nonce, &ctx->aes);
+}
+
+static void run_blake2b(struct bench_ctx *ctx, size_t len) {
+  crypto_generichash(ctx->out, crypto_generichash_BYTES, ctx->in, len, NULL, 0);
+}
+
+static void run_sha256(struct bench_ctx *ctx, size_t len) {
+  crypto_hash_sha256(ctx->out, ctx->in, len);
+}
+
+static void run_sha512(struct bench_ctx *ctx, size_t len) {
+  crypto_hash_sha512(ctx->out, ctx->in, len);
+}
+
+static int always_available(void) {
+  return 1;
+}
+
+struct primitive {
+  const char *name;
+  int (*available)(void);
+  void (*run)(struct bench_ctx *ctx, size_t len);
+};
+
+static const struct primitive primitives[] = {
+  { "secretbox_xsalsa20poly1305", always_available, run_secretbox },
+  { "aead_xchacha20poly1305_ietf", always_available, run_xchacha20poly1305 },
+  { "aead_aes256gcm", crypto_aead_aes256gcm_is_available, run_aes256gcm },
+  { "blake2b", always_available, run_blake2b },
+  { "sha256", always_available, run_sha256 },
+  { "sha512", always_available, run_sha512 },
+};
+
+struct run {
+  const struct primitive *prim;
+  size_t len;
+  double min_time;
+  struct bench_ctx *ctx;
+  unsigned long long bytes;
+};
+
+struct baseline {
+  char name[64];
+  size_t len;
+  int threads;
+  double mbps;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long cycle_count(void) {
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/* Calls the primitive until min_time has passed, checking the clock only
+ * every ~64 KiB of input so small messages are not dominated by timer
+ * overhead. */
+static void *bench_thread(void *arg) {
+  struct run *r = arg;
+  unsigned long batch = r->len >= 65536 ? 1 : (unsigned long)(65536 / r->len);
+  double start = now_seconds();
+  double elapsed;
+
+  r->prim->run(r->ctx, r->len);
+  r->bytes = 0;
+  do {
+    for (unsigned long i = 0; i < batch; i++) {
+      r->prim->run(r->ctx, r->len);
+    }
+    r->bytes += (unsigned long long)batch * r->len;
+    elapsed = now_seconds() - start;
+  } while (elapsed < r->min_time);
+  return NULL;
+}
+
+static int init_ctx(struct bench_ctx *ctx) {
+  ctx->in = malloc(MAX_SIZE);
+  ctx->out = malloc(MAX_SIZE + BUFFER_SLACK);
+  if (!ctx->in || !ctx->out) {
+    return -1;
+  }
+  randombytes_buf(ctx->in, MAX_SIZE);
+  randombytes_buf(ctx->key, sizeof ctx->key);
+  randombytes_buf(ctx->nonce, sizeof ctx->nonce);
+  if (crypto_aead_aes256gcm_is_available()) {
+    crypto_aead_aes256gcm_beforenm(&ctx->aes, ctx->key);
+  }
+  return 0;
+}
+
+/* Runs one primitive/size on `threads` threads at once and returns the
+ * aggregate MB/s; *cpb gets CPU cycles per byte summed over all threads,
+ * or 0 when no cycle counter is available. */
+static double bench_one(const struct primitive *prim, size_t len, int threads, double min_time,
+                        struct bench_ctx *ctxs, double ghz, double *cpb) {
+  struct run runs[MAX_THREADS];
+  pthread_t tids[MAX_THREADS];
+  unsigned long long c0 = cycle_count();
+  double t0 = now_seconds();
+
+  for (int t = 0; t < threads; t++) {
+    runs[t].prim = prim;
+    runs[t].len = len;
+    runs[t].min_time = min_time;
+    runs[t].ctx = &ctxs[t];
+    if (threads == 1) {
+      bench_thread(&runs[t]);
+    } else if (pthread_create(&tids[t], NULL, bench_thread, &runs[t]) != 0) {
+      return -1;
+    }
+  }
+  for (int t = 0; threads > 1 && t < threads; t++) {
+    pthread_join(tids[t], NULL);
+  }
+
+  double wall = now_seconds() - t0;
+  unsigned long long cycles = cycle_count() - c0;
+  unsigned long long bytes = 0;
+  for (int t = 0; t < threads; t++) {
+    bytes += runs[t].bytes;
+  }
+
+  double core_cycles = ghz > 0 ? wall * ghz * 1e9 : (double)cycles;
+  *cpb = core_cycles > 0 ? core_cycles * threads / (double)bytes : 0;
+  return (double)bytes / (1024.0 * 1024.0) / wall;
+}
+
+/* Reads a previous --json file back; each result sits on its own line. */
+static int load_baseline(const char *path, struct baseline *base, int max) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "Cannot open baseline: %s\n", path);
+    return -1;
+  }
+  char line[512];
+  int count = 0;
+  while (count < max && fgets(line, sizeof line, fp)) {
+    struct baseline *b = &base[count];
+    const char *p = strstr(line, "{\"primitive\"");
+    if (p && sscanf(p, "{\"primitive\": \"%63[^\"]\", \"bytes\": %zu, \"threads\": %d, \"mbps\": %lf",
+                    b->name, &b->len, &b->threads, &b->mbps) == 4) {
+      count++;
+    }
+  }
+  fclose(fp);
+  return count;
+}
+
+static double baseline_mbps(const struct baseline *base, int count, const char *name, size_t len, int threads) {
+  for (int i = 0; i < count; i++) {
+    if (base[i].len == len && base[i].threads == threads && strcmp(base[i].name, name) == 0) {
+      return base[i].mbps;
+    }
+  }
+  return 0;
+}
+
+static void print_usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [--json file] [--label name] [--threads N] [--time seconds]\n"
+                  "          [--max-size bytes] [--ghz F] [--compare baseline.json]\n", prog);
+  fprintf(stderr, "  Every primitive and size runs on 1 thread, and again on N threads if N > 1.\n");
+  fprintf(stderr, "  Cycles/byte come from the TSC on x86; elsewhere pass the core clock with --ghz.\n");
+  fprintf(stderr, "  --label defaults to the build profile (%s).\n", SODIUM_BENCH_PROFILE);
+  fprintf(stderr, "  --compare prints the speedup over a previous --json run, e.g. a portable build.\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *json_path = NULL;
+  const char *compare_path = NULL;
+  const char *label = SODIUM_BENCH_PROFILE;
+  int threads = 1;
+  double min_time = 0.2;
+  double ghz = 0;
+  size_t max_size = MAX_SIZE;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+      label = argv[++i];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      compare_path = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+      min_time = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--ghz") == 0 && i + 1 < argc) {
+      ghz = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+      max_size = (size_t)strtoull(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (threads < 1 || threads > MAX_THREADS || min_time <= 0 || ghz < 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (sodium_init() < 0) {
+    fprintf(stderr, "Failed to initialize libsodium\n");
+    return 1;
+  }
+
+  static struct baseline base[MAX_BASELINE];
+  int base_count = 0;
+  if (compare_path && (base_count = load_baseline(compare_path, base, MAX_BASELINE)) < 0) {
+    return 1;
+  }
+
+  struct bench_ctx *ctxs = calloc((size_t)threads, sizeof(struct bench_ctx));
+  int ok = ctxs != NULL;
+  for (int t = 0; ok && t < threads; t++) {
+    ok = init_ctx(&ctxs[t]) == 0;
+  }
+  if (!ok) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  FILE *json = NULL;
+  if (json_path && !(json = fopen(json_path, "w"))) {
+    fprintf(stderr, "Cannot create output file: %s\n", json_path);
+    return 1;
+  }
+  if (json) {
+    fprintf(json, "{\n  \"sodium_version\": \"%s\",\n  \"label\": \"%s\",\n"
+                  "  \"aes256gcm_available\": %d,\n  \"results\": [\n",
+            sodium_version_string(), label, crypto_aead_aes256gcm_is_available());
+  }
+
+  int thread_counts[2] = { 1, threads };
+  int runs = threads > 1 ? 2 : 1;
+
+  printf("libsodium %s, %s\n", sodium_version_string(), label);
+  printf("%-28s %9s %7s %10s %8s%s\n", "primitive", "bytes", "threads", "MB/s", "cyc/B",
+         base_count > 0 ? "  speedup" : "");
+
+  int first = 1;
+  for (size_t pi = 0; pi < sizeof(primitives) / sizeof(primitives[0]); pi++) {
+    const struct primitive *prim = &primitives[pi];
+    if (!prim->available()) {
+      printf("%-28s skipped: not available on this CPU\n", prim->name);
+      continue;
+    }
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]) && sizes[si] <= max_size; si++) {
+      for (int ri = 0; ri < runs; ri++) {
+        int n = thread_counts[ri];
+        double cpb;
+        double mbps = bench_one(prim, sizes[si], n, min_time, ctxs, ghz, &cpb);
+        if (mbps < 0) {
+          fprintf(stderr, "Cannot start benchmark threads\n");
+          return 1;
+        }
+
+        printf("%-28s %9zu %7d %10.1f %8.2f", prim->name, sizes[si], n, mbps, cpb);
+        double base_mbps = baseline_mbps(base, base_count, prim->name, sizes[si], n);
+        if (base_mbps > 0) {
+          printf("  %6.2fx", mbps / base_mbps);
+        }
+        printf("\n");
+
+        if (json) {
+          fprintf(json, "%s    {\"primitive\": \"%s\", \"bytes\": %zu, \"threads\": %d, \"mbps\": %.2f, "
+                        "\"cycles_per_byte\": %.3f}",
+                  first ? "" : ",\n", prim->name, sizes[si], n, mbps, cpb);
+          fflush(json);
+        }
+        first = 0;
+      }
+    }
+  }
+
+  if (json) {
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+  }
+  for (int t = 0; t < threads; t++) {
+    free(ctxs[t].in);
+    free(ctxs[t].out);
+  }
+  free(ctxs);
+  return 0;
+}
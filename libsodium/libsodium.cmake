@@ -7,6 +7,14 @@ include(ProcessorCount)
 
 option(USE_SHARED "Use shared libraries" OFF)
 option(USE_SYSTEM "Use libraries installed in system" OFF)
+set(LIBSODIUM_PERF_PROFILE "portable" CACHE STRING "LibSodium build profile when building from source (portable, native, minimal)")
+set_property(CACHE LIBSODIUM_PERF_PROFILE PROPERTY STRINGS portable native minimal)
+set(LIBSODIUM_MARCH "" CACHE STRING "Target CPU for the native profile (-march value); empty means the build machine")
+option(LIBSODIUM_LTO "Build LibSodium with link-time optimization" OFF)
+
+if(NOT LIBSODIUM_PERF_PROFILE MATCHES "^(portable|native|minimal)$")
+  message(FATAL_ERROR "Unsupported LIBSODIUM_PERF_PROFILE: ${LIBSODIUM_PERF_PROFILE} (expected portable, native or minimal)")
+endif()
 
 add_library(libsodium INTERFACE)
 
@@ -44,6 +52,37 @@ else()
   list(APPEND CONFIGURE_OPTIONS "--disable-shared")
 endif()
 
+# native: --enable-opt tunes for the CPU running configure, which is wrong
+# when cross-compiling, so then only an explicit LIBSODIUM_MARCH is honoured.
+set(LIBSODIUM_PROFILE_USED ${LIBSODIUM_PERF_PROFILE})
+set(LIBSODIUM_CFLAGS "")
+if(LIBSODIUM_PERF_PROFILE STREQUAL "native")
+  if(LIBSODIUM_MARCH)
+    set(LIBSODIUM_CFLAGS "-O3 -march=${LIBSODIUM_MARCH}")
+  elseif(CMAKE_CROSSCOMPILING)
+    message(WARNING "LIBSODIUM_PERF_PROFILE=native needs LIBSODIUM_MARCH when cross-compiling, using portable")
+    set(LIBSODIUM_PROFILE_USED "portable")
+  else()
+    list(APPEND CONFIGURE_OPTIONS "--enable-opt")
+    set(LIBSODIUM_CFLAGS "-O3 -march=native")
+  endif()
+elseif(LIBSODIUM_PERF_PROFILE STREQUAL "minimal")
+  list(APPEND CONFIGURE_OPTIONS "--enable-minimal")
+endif()
+
+# Setting CFLAGS replaces autoconf's default -O2, so keep it for LTO alone.
+if(LIBSODIUM_LTO)
+  if(NOT LIBSODIUM_CFLAGS)
+    set(LIBSODIUM_CFLAGS "-O2")
+  endif()
+  string(APPEND LIBSODIUM_CFLAGS " -flto")
+  list(APPEND CONFIGURE_OPTIONS "LDFLAGS=-flto")
+endif()
+string(STRIP "${LIBSODIUM_CFLAGS}" LIBSODIUM_CFLAGS)
+if(LIBSODIUM_CFLAGS)
+  list(APPEND CONFIGURE_OPTIONS "CFLAGS=${LIBSODIUM_CFLAGS}")
+endif()
+
 ProcessorCount(NPROCS)
 if(NPROCS EQUAL 0)
   set(NPROCS 1)
@@ -52,6 +91,7 @@ endif()
 set(MAKE_PARALLEL "-j${NPROCS}")
 
 if(${USE_SYSTEM})
+  set(LIBSODIUM_PROFILE_USED "system")
   if(CMAKE_SYSTEM_NAME STREQUAL "Windows")
     find_path(LIBSODIUM_INCLUDE_DIR
       NAMES sodium.h
@@ -118,6 +158,7 @@ elseif(DEFINED LIBSODIUM_INCLUDE_DIR AND DEFINED LIBSODIUM_LIB_DIR)
   get_filename_component(LIBSODIUM_INCLUDE_DIR "${LIBSODIUM_INCLUDE_DIR}" ABSOLUTE BASE_DIR ${CMAKE_CURRENT_SOURCE_DIR})
   get_filename_component(LIBSODIUM_LIB_DIR "${LIBSODIUM_LIB_DIR}" ABSOLUTE BASE_DIR ${CMAKE_CURRENT_SOURCE_DIR})
   message(STATUS "Using pre-built libsodium library in ${LIBSODIUM_LIB_DIR}")
+  set(LIBSODIUM_PROFILE_USED "prebuilt")
   
   include_directories(${LIBSODIUM_INCLUDE_DIR})
   link_directories(${LIBSODIUM_LIB_DIR})
@@ -193,5 +234,13 @@ else()
   message(FATAL_ERROR "Failed to build/load libsodium")
 endif()
 
+# Lets consumers see which flavour they link against, e.g.
+#   get_target_property(profile libsodium::libsodium LIBSODIUM_PERF_PROFILE)
+set_target_properties(libsodium::libsodium PROPERTIES LIBSODIUM_PERF_PROFILE "${LIBSODIUM_PROFILE_USED}")
+
+message(STATUS "Build profile: ${LIBSODIUM_PROFILE_USED}")
+if(LIBSODIUM_CFLAGS AND LIBSODIUM_PROFILE_USED MATCHES "^(portable|native|minimal)$")
+  message(STATUS "Configure CFLAGS: ${LIBSODIUM_CFLAGS}")
+endif()
 message(STATUS "Include directory: ${LIBSODIUM_INCLUDE_DIR}")
 message(STATUS "Library directory: ${LIBSODIUM_LIB_DIR}")
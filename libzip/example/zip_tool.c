@@ -1,11 +1,88 @@
+#define _FILE_OFFSET_BITS 64
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
 #include <zip.h>
+#include <zlib.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
 
 #define CHUNK 16384
+#define PARALLEL_CHUNK (256 * 1024)
+#define MAX_JOBS 64
+#define SAMPLE_SIZE 4096
+#define STORE_ENTROPY 7.5
+
+/* How new entries are compressed. Files that look incompressible are
+ * stored unless skip_incompressible is cleared. */
+struct compress_policy {
+    zip_int32_t method;
+    zip_uint32_t level;
+    int skip_incompressible;
+};
+
+static struct compress_policy policy = { ZIP_CM_DEFLATE, 0, 1 };
+
+static const struct {
+    const char *name;
+    zip_int32_t method;
+    zip_uint32_t max_level;
+} methods[] = {
+    { "store", ZIP_CM_STORE, 0 },
+    { "deflate", ZIP_CM_DEFLATE, 9 },
+    { "bzip2", ZIP_CM_BZIP2, 9 },
+#ifdef ZIP_CM_XZ
+    { "xz", ZIP_CM_XZ, 9 },
+#endif
+#ifdef ZIP_CM_ZSTD
+    { "zstd", ZIP_CM_ZSTD, 22 },
+#endif
+};
+
+/* Formats that are already compressed; deflating them only costs time. */
+static const char *stored_extensions[] = {
+    "7z", "apk", "avi", "bz2", "docx", "flac", "gif", "gz", "heic", "jar",
+    "jpeg", "jpg", "lz4", "mkv", "mov", "mp3", "mp4", "odt", "ogg", "png",
+    "pptx", "rar", "tgz", "webm", "webp", "woff", "woff2", "xlsx", "xz",
+    "zip", "zst",
+};
+
+/* One archive member in parallel mode. Workers deflate file contents into
+ * their own temp file; zip_close() later copies that data unchanged. */
+struct zip_job {
+    char *fs_path;
+    char *zip_path;
+    int is_dir;
+    FILE *data;
+    long long offset;
+    long long pos;
+    zip_uint64_t size;
+    zip_uint64_t comp_size;
+    zip_uint32_t crc;
+    zip_int32_t method;
+    time_t mtime;
+    int failed;
+    zip_error_t error;
+};
+
+struct job_list {
+    struct zip_job *jobs;
+    size_t count;
+    size_t cap;
+};
+
+struct job_queue {
+    pthread_mutex_t lock;
+    struct job_list *list;
+    size_t next;
+};
 
 int is_directory(const char* path) {
     struct stat path_stat;
@@ -15,48 +92,90 @@ int is_directory(const char* path) {
     return S_ISDIR(path_stat.st_mode);
 }
 
-int add_file_to_zip(zip_t *zipper, const char* filepath, const char* zip_path) {
-    FILE *file = fopen(filepath, "rb");
+static int has_stored_extension(const char* path) {
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/')) {
+        return 0;
+    }
+    ext++;
+    for (size_t i = 0; i < sizeof(stored_extensions) / sizeof(stored_extensions[0]); i++) {
+#ifdef _WIN32
+        if (_stricmp(ext, stored_extensions[i]) == 0) {
+#else
+        if (strcasecmp(ext, stored_extensions[i]) == 0) {
+#endif
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Shannon entropy of the first SAMPLE_SIZE bytes, in bits per byte. */
+static double sample_entropy(const char* path) {
+    FILE *file = fopen(path, "rb");
     if (!file) {
-        fprintf(stderr, "Failed to open file: %s\n", filepath);
-        return -1;
+        return 0.0;
+    }
+    unsigned char sample[SAMPLE_SIZE];
+    size_t len = fread(sample, 1, sizeof(sample), file);
+    fclose(file);
+    if (len == 0) {
+        return 0.0;
     }
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < len; i++) {
+        counts[sample[i]]++;
+    }
+    double entropy = 0.0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i]) {
+            double p = (double)counts[i] / (double)len;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
 
-    char *buffer = malloc(file_size);
-    if (!buffer) {
-        fclose(file);
-        return -1;
+static zip_int32_t choose_method(const char* filepath) {
+    if (policy.method == ZIP_CM_STORE || !policy.skip_incompressible) {
+        return policy.method;
     }
-    
-    if (fread(buffer, 1, file_size, file) != file_size) {
-        fprintf(stderr, "Failed to read file: %s\n", filepath);
-        free(buffer);
-        fclose(file);
-        return -1;
+    if (has_stored_extension(filepath) || sample_entropy(filepath) > STORE_ENTROPY) {
+        return ZIP_CM_STORE;
     }
-    fclose(file);
+    return policy.method;
+}
 
-    zip_source_t *source = zip_source_buffer(zipper, buffer, file_size, 1);
+static int add_file_with_method(zip_t *zipper, const char* filepath, const char* zip_path,
+                                zip_int32_t method, zip_flags_t flags) {
+    zip_source_t *source = zip_source_file(zipper, filepath, 0, -1);
     if (!source) {
-        fprintf(stderr, "Failed to create source for file: %s\n", filepath);
-        free(buffer);
+        fprintf(stderr, "Failed to create source for file: %s: %s\n", filepath, zip_strerror(zipper));
         return -1;
     }
 
-    zip_int64_t index = zip_file_add(zipper, zip_path, source, ZIP_FL_ENC_UTF_8);
+    zip_int64_t index = zip_file_add(zipper, zip_path, source, ZIP_FL_ENC_UTF_8 | flags);
     if (index < 0) {
         fprintf(stderr, "Failed to add file to zip: %s\n", zip_strerror(zipper));
         zip_source_free(source);
         return -1;
     }
 
+    if (zip_set_file_compression(zipper, (zip_uint64_t)index, method, method == ZIP_CM_STORE ? 0 : policy.level) < 0) {
+        fprintf(stderr, "Failed to set compression for %s: %s\n", zip_path, zip_strerror(zipper));
+        return -1;
+    }
+
     return 0;
 }
 
+/* Files are streamed from disk when zip_close() writes the archive, so
+ * memory use does not grow with the size or number of inputs. */
+int add_file_to_zip(zip_t *zipper, const char* filepath, const char* zip_path) {
+    return add_file_with_method(zipper, filepath, zip_path, choose_method(filepath), 0);
+}
+
 int add_dir_to_zip(zip_t *zipper, const char* dir_path, const char* zip_path) {
     DIR *dir = opendir(dir_path);
     if (!dir) {
@@ -105,6 +224,346 @@ int add_dir_to_zip(zip_t *zipper, const char* dir_path, const char* zip_path) {
     return 0;
 }
 
+static int job_add(struct job_list *list, const char *fs_path, const char *zip_path, int is_dir) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        struct zip_job *jobs = realloc(list->jobs, cap * sizeof(struct zip_job));
+        if (!jobs) {
+            return -1;
+        }
+        list->jobs = jobs;
+        list->cap = cap;
+    }
+
+    struct zip_job *job = &list->jobs[list->count];
+    memset(job, 0, sizeof(*job));
+    job->fs_path = strdup(fs_path);
+    job->zip_path = is_dir ? malloc(strlen(zip_path) + 2) : strdup(zip_path);
+    if (!job->fs_path || !job->zip_path) {
+        free(job->fs_path);
+        free(job->zip_path);
+        return -1;
+    }
+    if (is_dir) {
+        sprintf(job->zip_path, "%s/", zip_path);
+    }
+    job->is_dir = is_dir;
+    zip_error_init(&job->error);
+    list->count++;
+    return 0;
+}
+
+static void job_list_free(struct job_list *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->jobs[i].fs_path);
+        free(list->jobs[i].zip_path);
+        zip_error_fini(&list->jobs[i].error);
+    }
+    free(list->jobs);
+}
+
+/* Same traversal as add_dir_to_zip(), recorded so the archive order does
+ * not depend on which worker finishes first. */
+static int collect_dir(struct job_list *list, const char* dir_path, const char* zip_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        fprintf(stderr, "Failed to open directory: %s\n", dir_path);
+        return -1;
+    }
+
+    if (strlen(zip_path) > 0 && job_add(list, dir_path, zip_path, 1) < 0) {
+        closedir(dir);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char full_path[1024];
+        char new_zip_path[1024];
+        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
+        snprintf(new_zip_path, sizeof(new_zip_path), "%s%s%s",
+                zip_path,
+                (strlen(zip_path) > 0) ? "/" : "",
+                entry->d_name);
+
+        int result = is_directory(full_path)
+            ? collect_dir(list, full_path, new_zip_path)
+            : job_add(list, full_path, new_zip_path, 0);
+        if (result < 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+static int deflate_job(struct zip_job *job, FILE *data, z_stream *strm, unsigned char *in, unsigned char *out) {
+    FILE *file = fopen(job->fs_path, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open file: %s\n", job->fs_path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0) {
+        job->mtime = st.st_mtime;
+    }
+
+    if (deflateReset(strm) != Z_OK) {
+        fclose(file);
+        return -1;
+    }
+
+    job->data = data;
+    job->offset = ftello(data);
+    job->crc = crc32(0L, Z_NULL, 0);
+
+    int flush;
+    do {
+        size_t len = fread(in, 1, PARALLEL_CHUNK, file);
+        if (ferror(file)) {
+            fprintf(stderr, "Failed to read file: %s\n", job->fs_path);
+            fclose(file);
+            return -1;
+        }
+        job->size += len;
+        job->crc = crc32(job->crc, in, (uInt)len);
+        flush = feof(file) ? Z_FINISH : Z_NO_FLUSH;
+
+        strm->next_in = in;
+        strm->avail_in = (uInt)len;
+        do {
+            strm->next_out = out;
+            strm->avail_out = PARALLEL_CHUNK;
+            deflate(strm, flush);
+            size_t have = PARALLEL_CHUNK - strm->avail_out;
+            if (fwrite(out, 1, have, data) != have) {
+                fprintf(stderr, "Failed to write temporary data for: %s\n", job->fs_path);
+                fclose(file);
+                return -1;
+            }
+            job->comp_size += have;
+        } while (strm->avail_out == 0);
+    } while (flush != Z_FINISH);
+
+    fclose(file);
+    return 0;
+}
+
+struct worker {
+    pthread_t thread;
+    struct job_queue *queue;
+    FILE *data;
+};
+
+static void* deflate_worker(void *arg) {
+    struct worker *w = arg;
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    unsigned char *in = malloc(PARALLEL_CHUNK);
+    unsigned char *out = malloc(PARALLEL_CHUNK);
+    int level = policy.level ? (int)policy.level : Z_DEFAULT_COMPRESSION;
+    int ok = in && out && deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+    while (1) {
+        pthread_mutex_lock(&w->queue->lock);
+        size_t i = w->queue->next++;
+        pthread_mutex_unlock(&w->queue->lock);
+        if (i >= w->queue->list->count) {
+            break;
+        }
+
+        /* Only deflate runs here; stored entries need no work and other
+         * methods are left to libzip during zip_close(). */
+        struct zip_job *job = &w->queue->list->jobs[i];
+        if (!job->is_dir) {
+            job->method = choose_method(job->fs_path);
+            if (job->method == ZIP_CM_DEFLATE) {
+                job->failed = !ok || deflate_job(job, w->data, &strm, in, out) != 0;
+            }
+        }
+    }
+
+    if (ok) {
+        deflateEnd(&strm);
+    }
+    free(in);
+    free(out);
+    return NULL;
+}
+
+/* Source that hands libzip the deflated bytes together with their CRC and
+ * sizes. Because the reported method matches the entry's method, libzip
+ * writes the data as is instead of compressing it again. */
+static zip_int64_t predeflated_source(void *userdata, void *data, zip_uint64_t len, zip_source_cmd_t cmd) {
+    struct zip_job *job = userdata;
+
+    switch (cmd) {
+    case ZIP_SOURCE_OPEN:
+        if (fseeko(job->data, job->offset, SEEK_SET) != 0) {
+            zip_error_set(&job->error, ZIP_ER_SEEK, 0);
+            return -1;
+        }
+        job->pos = 0;
+        return 0;
+
+    case ZIP_SOURCE_READ: {
+        zip_uint64_t left = job->comp_size - (zip_uint64_t)job->pos;
+        size_t n = (size_t)(len < left ? len : left);
+        if (n > 0 && fread(data, 1, n, job->data) != n) {
+            zip_error_set(&job->error, ZIP_ER_READ, 0);
+            return -1;
+        }
+        job->pos += n;
+        return (zip_int64_t)n;
+    }
+
+    case ZIP_SOURCE_CLOSE:
+    case ZIP_SOURCE_FREE:
+        return 0;
+
+    case ZIP_SOURCE_STAT: {
+        zip_stat_t *st = data;
+        zip_stat_init(st);
+        st->valid = ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE | ZIP_STAT_COMP_METHOD | ZIP_STAT_CRC | ZIP_STAT_MTIME;
+        st->size = job->size;
+        st->comp_size = job->comp_size;
+        st->comp_method = ZIP_CM_DEFLATE;
+        st->crc = job->crc;
+        st->mtime = job->mtime;
+        return sizeof(*st);
+    }
+
+    case ZIP_SOURCE_ERROR:
+        return zip_error_to_data(&job->error, data, len);
+
+    case ZIP_SOURCE_SUPPORTS:
+        return zip_source_make_command_bitmap(ZIP_SOURCE_OPEN, ZIP_SOURCE_READ, ZIP_SOURCE_CLOSE,
+                                              ZIP_SOURCE_STAT, ZIP_SOURCE_ERROR, ZIP_SOURCE_FREE, -1);
+
+    default:
+        zip_error_set(&job->error, ZIP_ER_OPNOTSUPP, 0);
+        return -1;
+    }
+}
+
+static int add_jobs_to_zip(zip_t *zipper, struct job_list *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        struct zip_job *job = &list->jobs[i];
+        if (job->is_dir) {
+            if (zip_dir_add(zipper, job->zip_path, ZIP_FL_ENC_UTF_8) < 0) {
+                fprintf(stderr, "Failed to add directory to zip: %s\n", zip_strerror(zipper));
+                return -1;
+            }
+            continue;
+        }
+        if (job->failed) {
+            return -1;
+        }
+        if (job->method != ZIP_CM_DEFLATE) {
+            if (add_file_with_method(zipper, job->fs_path, job->zip_path, job->method, 0) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        zip_source_t *source = zip_source_function(zipper, predeflated_source, job);
+        if (!source) {
+            fprintf(stderr, "Failed to create source for file: %s\n", job->fs_path);
+            return -1;
+        }
+        if (zip_file_add(zipper, job->zip_path, source, ZIP_FL_ENC_UTF_8) < 0) {
+            fprintf(stderr, "Failed to add file to zip: %s\n", zip_strerror(zipper));
+            zip_source_free(source);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int create_zip_parallel(const char* zip_path, const char* source_path, int jobs) {
+    struct job_list list = { NULL, 0, 0 };
+    const char *base_name = strrchr(source_path, '/');
+    base_name = base_name ? base_name + 1 : source_path;
+
+    int result = is_directory(source_path)
+        ? collect_dir(&list, source_path, base_name)
+        : job_add(&list, source_path, base_name, 0);
+    if (result < 0) {
+        job_list_free(&list);
+        return -1;
+    }
+
+    struct job_queue queue;
+    queue.list = &list;
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    struct worker workers[MAX_JOBS];
+    int started = 0;
+    for (; started < jobs; started++) {
+        workers[started].queue = &queue;
+        workers[started].data = tmpfile();
+        if (!workers[started].data) {
+            fprintf(stderr, "Failed to create temporary file\n");
+            result = -1;
+            break;
+        }
+        if (pthread_create(&workers[started].thread, NULL, deflate_worker, &workers[started]) != 0) {
+            fprintf(stderr, "Failed to start worker thread\n");
+            fclose(workers[started].data);
+            result = -1;
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+
+    /* Workers are done with their temp files; libzip reads them back in
+     * archive order during zip_close(). */
+    for (int i = 0; result == 0 && i < started; i++) {
+        if (fflush(workers[i].data) != 0) {
+            fprintf(stderr, "Failed to write temporary data\n");
+            result = -1;
+        }
+    }
+
+    if (result == 0) {
+        int err = 0;
+        zip_t *zipper = zip_open(zip_path, ZIP_CREATE | ZIP_TRUNCATE, &err);
+        if (!zipper) {
+            zip_error_t error;
+            zip_error_init_with_code(&error, err);
+            fprintf(stderr, "Failed to create zip: %s\n", zip_error_strerror(&error));
+            zip_error_fini(&error);
+            result = -1;
+        } else {
+            result = add_jobs_to_zip(zipper, &list);
+            if (result < 0) {
+                zip_discard(zipper);
+            } else if (zip_close(zipper) < 0) {
+                fprintf(stderr, "Failed to close zip file: %s\n", zip_strerror(zipper));
+                zip_discard(zipper);
+                result = -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        fclose(workers[i].data);
+    }
+    job_list_free(&list);
+    return result;
+}
+
 int create_zip(const char* zip_path, const char* source_path) {
     int err = 0;
     zip_t *zipper = zip_open(zip_path, ZIP_CREATE | ZIP_TRUNCATE, &err);
@@ -135,6 +594,150 @@ int create_zip(const char* zip_path, const char* source_path) {
     return result;
 }
 
+static int file_crc(const char* path, zip_uint32_t *crc) {
+    FILE *file = fopen(path, "rb");
+    unsigned char *buffer = malloc(PARALLEL_CHUNK);
+    if (!file || !buffer) {
+        if (file) {
+            fclose(file);
+        }
+        free(buffer);
+        return -1;
+    }
+
+    uLong value = crc32(0L, Z_NULL, 0);
+    size_t len;
+    while ((len = fread(buffer, 1, PARALLEL_CHUNK, file)) > 0) {
+        value = crc32(value, buffer, (uInt)len);
+    }
+    int result = ferror(file) ? -1 : 0;
+    fclose(file);
+    free(buffer);
+    *crc = (zip_uint32_t)value;
+    return result;
+}
+
+/* Entries whose size and mtime match the source are left alone, so
+ * zip_close() copies their compressed data unchanged. DOS timestamps only
+ * have two second resolution. When only the mtime differs, the CRC decides
+ * whether the content changed or just needs its timestamp refreshed. */
+static int update_entry(zip_t *zipper, zip_int64_t index, const struct zip_job *job, int *replaced) {
+    struct stat fs;
+    zip_stat_t zs;
+    *replaced = 1;
+    if (index < 0 || stat(job->fs_path, &fs) != 0 || zip_stat_index(zipper, (zip_uint64_t)index, 0, &zs) < 0) {
+        return 0;
+    }
+    if (!(zs.valid & ZIP_STAT_SIZE) || zs.size != (zip_uint64_t)fs.st_size) {
+        return 0;
+    }
+
+    double diff = (zs.valid & ZIP_STAT_MTIME) ? difftime(fs.st_mtime, zs.mtime) : 3.0;
+    if (diff >= -2.0 && diff <= 2.0) {
+        *replaced = 0;
+        return 0;
+    }
+
+    zip_uint32_t crc;
+    if (!(zs.valid & ZIP_STAT_CRC) || file_crc(job->fs_path, &crc) < 0 || crc != zs.crc) {
+        return 0;
+    }
+    *replaced = 0;
+    if (zip_file_set_mtime(zipper, (zip_uint64_t)index, fs.st_mtime, 0) < 0) {
+        fprintf(stderr, "Failed to set mtime for %s: %s\n", job->zip_path, zip_strerror(zipper));
+        return -1;
+    }
+    return 0;
+}
+
+int update_zip(const char* zip_path, const char* source_path) {
+    struct job_list list = { NULL, 0, 0 };
+    const char *base_name = strrchr(source_path, '/');
+    base_name = base_name ? base_name + 1 : source_path;
+
+    int result = is_directory(source_path)
+        ? collect_dir(&list, source_path, base_name)
+        : job_add(&list, source_path, base_name, 0);
+    if (result < 0) {
+        job_list_free(&list);
+        return -1;
+    }
+
+    int err = 0;
+    zip_t *zipper = zip_open(zip_path, ZIP_CREATE, &err);
+    if (!zipper) {
+        zip_error_t error;
+        zip_error_init_with_code(&error, err);
+        fprintf(stderr, "Failed to open zip: %s\n", zip_error_strerror(&error));
+        zip_error_fini(&error);
+        job_list_free(&list);
+        return -1;
+    }
+
+    zip_int64_t num_entries = zip_get_num_entries(zipper, 0);
+    char *seen = calloc((size_t)num_entries + 1, 1);
+    if (!seen) {
+        zip_discard(zipper);
+        job_list_free(&list);
+        return -1;
+    }
+
+    size_t added = 0, replaced = 0, unchanged = 0, deleted = 0;
+    for (size_t i = 0; result == 0 && i < list.count; i++) {
+        struct zip_job *job = &list.jobs[i];
+        zip_int64_t index = zip_name_locate(zipper, job->zip_path, 0);
+        if (index >= 0 && index < num_entries) {
+            seen[index] = 1;
+        }
+
+        if (job->is_dir) {
+            if (index < 0 && zip_dir_add(zipper, job->zip_path, ZIP_FL_ENC_UTF_8) < 0) {
+                fprintf(stderr, "Failed to add directory to zip: %s\n", zip_strerror(zipper));
+                result = -1;
+            }
+            continue;
+        }
+
+        int changed;
+        result = update_entry(zipper, index, job, &changed);
+        if (result == 0 && changed) {
+            result = add_file_with_method(zipper, job->fs_path, job->zip_path,
+                                          choose_method(job->fs_path), ZIP_FL_OVERWRITE);
+            if (index < 0) {
+                added++;
+            } else {
+                replaced++;
+            }
+        } else if (result == 0) {
+            unchanged++;
+        }
+    }
+
+    for (zip_int64_t i = 0; result == 0 && i < num_entries; i++) {
+        if (!seen[i]) {
+            if (zip_delete(zipper, (zip_uint64_t)i) < 0) {
+                fprintf(stderr, "Failed to delete entry: %s\n", zip_strerror(zipper));
+                result = -1;
+            }
+            deleted++;
+        }
+    }
+    free(seen);
+
+    if (result < 0) {
+        zip_discard(zipper);
+    } else if (zip_close(zipper) < 0) {
+        fprintf(stderr, "Failed to close zip file: %s\n", zip_strerror(zipper));
+        zip_discard(zipper);
+        result = -1;
+    } else {
+        printf("%zu added, %zu replaced, %zu deleted, %zu unchanged\n", added, replaced, deleted, unchanged);
+    }
+
+    job_list_free(&list);
+    return result;
+}
+
 int extract_zip(const char* zip_path, const char* extract_dir) {
     int err = 0;
     zip_t *zip = zip_open(zip_path, 0, &err);
@@ -204,27 +807,327 @@ int extract_zip(const char* zip_path, const char* extract_dir) {
     return 0;
 }
 
+static void make_dir(const char* path) {
+#ifdef _WIN32
+    mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+/* Creates every missing parent of path, like mkdir -p on its dirname. */
+static void make_parent_dirs(const char* path) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char *p = buf + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            make_dir(buf);
+            *p = '/';
+        }
+    }
+}
+
+struct extract_queue {
+    pthread_mutex_t lock;
+    const char *zip_path;
+    zip_int64_t num_entries;
+    zip_int64_t next;
+    int failed;
+};
+
+static int extract_entry(zip_t *zip, zip_uint64_t index, const char *full_path,
+                         zip_uint64_t size, char *buffer) {
+    zip_file_t *file = zip_fopen_index(zip, index, 0);
+    if (!file) {
+        fprintf(stderr, "Failed to open file in zip: %s\n", zip_strerror(zip));
+        return -1;
+    }
+
+    int result = 0;
+    zip_int64_t count;
+#ifdef _WIN32
+    (void)size;
+    FILE *out = fopen(full_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to create output file: %s\n", full_path);
+        zip_fclose(file);
+        return -1;
+    }
+    while ((count = zip_fread(file, buffer, PARALLEL_CHUNK)) > 0) {
+        if (fwrite(buffer, 1, (size_t)count, out) != (size_t)count) {
+            result = -1;
+            break;
+        }
+    }
+    if (fclose(out) != 0) {
+        result = -1;
+    }
+#else
+    int fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create output file: %s\n", full_path);
+        zip_fclose(file);
+        return -1;
+    }
+    /* Reserve the whole file first so the filesystem can lay it out in one
+     * extent; not every filesystem supports this, which is fine. */
+    if (size > 0) {
+        posix_fallocate(fd, 0, (off_t)size);
+    }
+    off_t offset = 0;
+    while ((count = zip_fread(file, buffer, PARALLEL_CHUNK)) > 0) {
+        if (pwrite(fd, buffer, (size_t)count, offset) != count) {
+            result = -1;
+            break;
+        }
+        offset += count;
+    }
+    if (close(fd) != 0) {
+        result = -1;
+    }
+#endif
+    if (count < 0) {
+        fprintf(stderr, "Failed to read file in zip: %s\n", full_path);
+        result = -1;
+    } else if (result < 0) {
+        fprintf(stderr, "Failed to write output file: %s\n", full_path);
+    }
+
+    zip_fclose(file);
+    return result;
+}
+
+static void* extract_worker(void *arg) {
+    struct extract_queue *queue = arg;
+    char *buffer = malloc(PARALLEL_CHUNK);
+    int err = 0;
+    zip_t *zip = buffer ? zip_open(queue->zip_path, ZIP_RDONLY, &err) : NULL;
+    int failed = !zip;
+
+    while (zip) {
+        pthread_mutex_lock(&queue->lock);
+        zip_int64_t i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (i >= queue->num_entries) {
+            break;
+        }
+
+        zip_stat_t st;
+        if (zip_stat_index(zip, (zip_uint64_t)i, 0, &st) < 0 || !(st.valid & ZIP_STAT_NAME)) {
+            failed = 1;
+            continue;
+        }
+        size_t len = strlen(st.name);
+        if (len == 0 || st.name[len - 1] == '/') {
+            continue;
+        }
+
+        char full_path[1024];
+        snprintf(full_path, sizeof(full_path), "./%s", st.name);
+        zip_uint64_t size = (st.valid & ZIP_STAT_SIZE) ? st.size : 0;
+        if (extract_entry(zip, (zip_uint64_t)i, full_path, size, buffer) < 0) {
+            failed = 1;
+        }
+    }
+
+    if (zip) {
+        zip_discard(zip);
+    }
+    free(buffer);
+
+    if (failed) {
+        pthread_mutex_lock(&queue->lock);
+        queue->failed = 1;
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+
+int extract_zip_parallel(const char* zip_path, int jobs) {
+    int err = 0;
+    zip_t *zip = zip_open(zip_path, ZIP_RDONLY, &err);
+    if (!zip) {
+        zip_error_t error;
+        zip_error_init_with_code(&error, err);
+        fprintf(stderr, "Failed to open zip: %s\n", zip_error_strerror(&error));
+        zip_error_fini(&error);
+        return -1;
+    }
+
+    /* Create the directory tree once, before any worker writes files, so
+     * workers never race on mkdir. */
+    zip_int64_t num_entries = zip_get_num_entries(zip, 0);
+    char last_parent[1024] = "";
+    for (zip_int64_t i = 0; i < num_entries; i++) {
+        const char* name = zip_get_name(zip, (zip_uint64_t)i, 0);
+        if (!name) {
+            continue;
+        }
+        char full_path[1024];
+        snprintf(full_path, sizeof(full_path), "./%s", name);
+
+        char *p = strrchr(full_path, '/');
+        *p = '\0';
+        if (strcmp(full_path, last_parent) != 0) {
+            snprintf(last_parent, sizeof(last_parent), "%s", full_path);
+            *p = '/';
+            make_parent_dirs(full_path);
+        }
+    }
+    zip_discard(zip);
+
+    struct extract_queue queue;
+    queue.zip_path = zip_path;
+    queue.num_entries = num_entries;
+    queue.next = 0;
+    queue.failed = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    pthread_t threads[MAX_JOBS];
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, extract_worker, &queue) != 0) {
+            fprintf(stderr, "Failed to start worker thread\n");
+            queue.failed = 1;
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+
+    return queue.failed ? -1 : 0;
+}
+
+static void report_max_rss(void) {
+#ifdef _WIN32
+    fprintf(stderr, "Peak RSS is not available on this platform\n");
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        long kib = usage.ru_maxrss / 1024;
+#else
+        long kib = usage.ru_maxrss;
+#endif
+        printf("Peak RSS: %ld KiB\n", kib);
+    }
+#endif
+}
+
+static void print_usage(const char* prog) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  Create zip:    %s -c [-j threads] [-m method] [-l level] [--no-skip] [--max-rss] <file|directory>\n", prog);
+    fprintf(stderr, "  Update zip:    %s -u [-m method] [-l level] [--no-skip] [--max-rss] <file|directory>\n", prog);
+    fprintf(stderr, "  Extract zip:   %s -x [-j threads] [--max-rss] <file.zip>\n", prog);
+    fprintf(stderr, "Methods:");
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (zip_compression_method_supported(methods[i].method, 1)) {
+            fprintf(stderr, " %s", methods[i].name);
+        }
+    }
+    fprintf(stderr, " (default deflate)\n");
+    fprintf(stderr, "Already-compressed files are stored unless --no-skip is given.\n");
+}
+
+static int parse_method(const char* name, zip_uint32_t level) {
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (strcmp(name, methods[i].name) != 0) {
+            continue;
+        }
+        if (!zip_compression_method_supported(methods[i].method, 1)) {
+            fprintf(stderr, "Compression method %s is not supported by this libzip build\n", name);
+            return -1;
+        }
+        if (level > methods[i].max_level) {
+            fprintf(stderr, "Level for %s must be between 0 and %u\n", name, methods[i].max_level);
+            return -1;
+        }
+        policy.method = methods[i].method;
+        policy.level = level;
+        return 0;
+    }
+    fprintf(stderr, "Unknown compression method: %s\n", name);
+    return -1;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 3 || (strcmp(argv[1], "-c") != 0 && strcmp(argv[1], "-x") != 0)) {
-        fprintf(stderr, "Usage:\n");
-        fprintf(stderr, "  Create zip:    %s -c <file|directory>\n", argv[0]);
-        fprintf(stderr, "  Extract zip:   %s -x <file.zip>\n", argv[0]);
+    const char* mode = NULL;
+    const char* path = NULL;
+    int jobs = 1;
+    int show_rss = 0;
+    const char* method = "deflate";
+    int level = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "-x") == 0) {
+            mode = argv[i];
+        } else if (strcmp(argv[i], "--max-rss") == 0) {
+            show_rss = 1;
+        } else if (strcmp(argv[i], "--no-skip") == 0) {
+            policy.skip_incompressible = 0;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            method = argv[++i];
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            level = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            mode = NULL;
+            break;
+        }
+    }
+
+    if (!mode || !path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (jobs < 1 || jobs > MAX_JOBS) {
+        fprintf(stderr, "Thread count must be between 1 and %d\n", MAX_JOBS);
+        return 1;
+    }
+
+    if (level < 0) {
+        fprintf(stderr, "Compression level must not be negative\n");
+        return 1;
+    }
+
+    if (parse_method(method, (zip_uint32_t)level) < 0) {
         return 1;
     }
 
-    if (strcmp(argv[1], "-c") == 0) {
-        const char* source_path = argv[2];
+    if (strcmp(mode, "-c") == 0) {
+        const char* source_path = path;
         char zip_path[1024];
         snprintf(zip_path, sizeof(zip_path), "%s.zip", source_path);
         
         printf("Creating zip archive %s from %s\n", zip_path, source_path);
-        if (create_zip(zip_path, source_path) != 0) {
+        int result = jobs > 1
+            ? create_zip_parallel(zip_path, source_path, jobs)
+            : create_zip(zip_path, source_path);
+        if (result != 0) {
             fprintf(stderr, "Failed to create zip archive\n");
             return 1;
         }
         printf("Zip archive created successfully\n");
+    } else if (strcmp(mode, "-u") == 0) {
+        const char* source_path = path;
+        char zip_path[1024];
+        snprintf(zip_path, sizeof(zip_path), "%s.zip", source_path);
+
+        printf("Updating zip archive %s from %s\n", zip_path, source_path);
+        if (update_zip(zip_path, source_path) != 0) {
+            fprintf(stderr, "Failed to update zip archive\n");
+            return 1;
+        }
+        printf("Zip archive updated successfully\n");
     } else {
-        const char* zip_path = argv[2];
+        const char* zip_path = path;
         size_t len = strlen(zip_path);
         
         if (len < 5 || strcmp(zip_path + len - 4, ".zip") != 0) {
@@ -233,12 +1136,18 @@ int main(int argc, char* argv[]) {
         }
         
         printf("Extracting %s to current directory\n", zip_path);
-        if (extract_zip(zip_path, ".") != 0) {
+        int result = jobs > 1
+            ? extract_zip_parallel(zip_path, jobs)
+            : extract_zip(zip_path, ".");
+        if (result != 0) {
             fprintf(stderr, "Failed to extract zip archive\n");
             return 1;
         }
         printf("Zip archive extracted successfully\n");
     }
 
+    if (show_rss) {
+        report_max_rss();
+    }
     return 0;
 }
@@ -12,6 +12,10 @@ option(ENABLE_CRYPTO "Enable encryption support" ON)
 option(USE_OPENSSL "Use OpenSSL library" OFF)
 option(USE_MBEDTLS "Use MbedTLS library" OFF)
 
+option(ENABLE_BZIP2 "Enable bzip2 compression support" OFF)
+option(ENABLE_LZMA "Enable xz/lzma compression support" OFF)
+option(ENABLE_ZSTD "Enable zstd compression support" OFF)
+
 if(ENABLE_CRYPTO)
     if(USE_OPENSSL AND USE_MBEDTLS)
         message(FATAL_ERROR "Only one crypto library can be enabled at a time")
@@ -171,6 +175,53 @@ macro(setup_mbedtls)
     endif()
 endmacro()
 
+macro(setup_codec_library CODEC_NAME CODEC_TARGET CODEC_LIB CODEC_HEADER)
+    validate_dirs_for_cross_compile(${CODEC_NAME} ${CODEC_NAME}_INCLUDE_DIR ${CODEC_NAME}_LIB_DIR)
+
+    if(USE_SHARED)
+        set(CODEC_LIB_NAME "${LIB_PREFIX}${CODEC_LIB}${SHARED_LIB_SUFFIX}")
+    else()
+        set(CODEC_LIB_NAME "${LIB_PREFIX}${CODEC_LIB}${STATIC_LIB_SUFFIX}")
+    endif()
+
+    if(DEFINED ${CODEC_NAME}_INCLUDE_DIR AND DEFINED ${CODEC_NAME}_LIB_DIR)
+        get_filename_component(${CODEC_NAME}_INCLUDE_DIR "${${CODEC_NAME}_INCLUDE_DIR}" ABSOLUTE BASE_DIR ${CMAKE_CURRENT_SOURCE_DIR})
+        get_filename_component(${CODEC_NAME}_LIB_DIR "${${CODEC_NAME}_LIB_DIR}" ABSOLUTE BASE_DIR ${CMAKE_CURRENT_SOURCE_DIR})
+        set(${CODEC_NAME}_LIBRARY "${${CODEC_NAME}_LIB_DIR}/${CODEC_LIB_NAME}")
+    else()
+        find_path(${CODEC_NAME}_INCLUDE_DIR
+            NAMES ${CODEC_HEADER}
+            PATHS /usr/include /usr/local/include
+            REQUIRED
+        )
+
+        find_library(${CODEC_NAME}_LIBRARY
+            NAMES ${CODEC_LIB_NAME} ${CODEC_LIB}
+            PATHS /usr/lib /usr/local/lib /usr/lib64 /usr/local/lib64
+            REQUIRED
+        )
+    endif()
+
+    if(NOT TARGET ${CODEC_TARGET})
+        add_library(${CODEC_TARGET} UNKNOWN IMPORTED GLOBAL)
+        set_target_properties(${CODEC_TARGET} PROPERTIES
+            IMPORTED_LOCATION "${${CODEC_NAME}_LIBRARY}"
+            INTERFACE_INCLUDE_DIRECTORIES "${${CODEC_NAME}_INCLUDE_DIR}")
+    endif()
+endmacro()
+
+macro(setup_codec_libraries)
+    if(ENABLE_BZIP2)
+        setup_codec_library(BZIP2 BZip2::BZip2 bz2 bzlib.h)
+    endif()
+    if(ENABLE_LZMA)
+        setup_codec_library(LZMA LibLZMA::LibLZMA lzma lzma.h)
+    endif()
+    if(ENABLE_ZSTD)
+        setup_codec_library(ZSTD zstd::libzstd zstd zstd.h)
+    endif()
+endmacro()
+
 macro(setup_zip_target)
     if(NOT TARGET LIBZIP::LIBZIP)
         add_library(LIBZIP::LIBZIP UNKNOWN IMPORTED GLOBAL)
@@ -200,6 +251,19 @@ macro(setup_zip_target)
         endif()
     endif()
 
+    if(ENABLE_BZIP2)
+        set_property(TARGET LIBZIP::LIBZIP APPEND PROPERTY
+            INTERFACE_LINK_LIBRARIES BZip2::BZip2)
+    endif()
+    if(ENABLE_LZMA)
+        set_property(TARGET LIBZIP::LIBZIP APPEND PROPERTY
+            INTERFACE_LINK_LIBRARIES LibLZMA::LibLZMA)
+    endif()
+    if(ENABLE_ZSTD)
+        set_property(TARGET LIBZIP::LIBZIP APPEND PROPERTY
+            INTERFACE_LINK_LIBRARIES zstd::libzstd)
+    endif()
+
     if(TARGET libzip_build)
         add_dependencies(LIBZIP::LIBZIP libzip_build)
     endif()
@@ -253,6 +317,7 @@ else()
 endif()
 
 setup_crypto_library()
+setup_codec_libraries()
 
 if(DEFINED LIBZIP_INCLUDE_DIR AND DEFINED LIBZIP_LIB_DIR)
     get_filename_component(LIBZIP_INCLUDE_DIR "${LIBZIP_INCLUDE_DIR}" ABSOLUTE BASE_DIR ${CMAKE_CURRENT_SOURCE_DIR})
@@ -328,6 +393,9 @@ elseif(DEFINED LIBZIP_DIR AND EXISTS ${LIBZIP_DIR})
         -DENABLE_OPENSSL=${USE_OPENSSL}
         -DENABLE_MBEDTLS=${USE_MBEDTLS}
         -DENABLE_GNUTLS=OFF
+        -DENABLE_BZIP2=${ENABLE_BZIP2}
+        -DENABLE_LZMA=${ENABLE_LZMA}
+        -DENABLE_ZSTD=${ENABLE_ZSTD}
     )
 
     if(USE_OPENSSL AND DEFINED OPENSSL_INCLUDE_DIR)
@@ -345,6 +413,27 @@ elseif(DEFINED LIBZIP_DIR AND EXISTS ${LIBZIP_DIR})
         )
     endif()
 
+    if(ENABLE_BZIP2)
+        list(APPEND LIBZIP_CMAKE_ARGS
+            -DBZIP2_INCLUDE_DIR=${BZIP2_INCLUDE_DIR}
+            -DBZIP2_LIBRARY_RELEASE=${BZIP2_LIBRARY}
+        )
+    endif()
+
+    if(ENABLE_LZMA)
+        list(APPEND LIBZIP_CMAKE_ARGS
+            -DLIBLZMA_INCLUDE_DIR=${LZMA_INCLUDE_DIR}
+            -DLIBLZMA_LIBRARY=${LZMA_LIBRARY}
+        )
+    endif()
+
+    if(ENABLE_ZSTD)
+        list(APPEND LIBZIP_CMAKE_ARGS
+            -DZstd_INCLUDE_DIR=${ZSTD_INCLUDE_DIR}
+            -DZstd_LIBRARY=${ZSTD_LIBRARY}
+        )
+    endif()
+
     ProcessorCount(NPROCS)
     if(NPROCS EQUAL 0)
         set(NPROCS 1)
@@ -381,3 +470,6 @@ if(USE_OPENSSL)
 elseif(USE_MBEDTLS)
   message(STATUS "  Encryption Library: MbedTLS")
 endif()
+message(STATUS "  bzip2 Support: ${ENABLE_BZIP2}")
+message(STATUS "  xz/lzma Support: ${ENABLE_LZMA}")
+message(STATUS "  zstd Support: ${ENABLE_ZSTD}")
@@ -0,0 +1,13 @@
+/*
+ * MBEDTLS_CONFIG_PROFILE=full
+ *
+ * Everything the default mbedtls_config.h enables, plus the buffer
+ * allocator so an application can run mbedTLS from a fixed arena. This
+ * file is appended to mbedtls_config.h by mbedtls.cmake.
+ */
+
+/* mbedtls_calloc/mbedtls_free can be pointed at a static arena with
+ * mbedtls_memory_buffer_alloc_init(). The example server's usage report
+ * needs MBEDTLS_MEMORY_DEBUG, which the CMake option of the same name adds. */
+#define MBEDTLS_PLATFORM_MEMORY
+#define MBEDTLS_MEMORY_BUFFER_ALLOC_C
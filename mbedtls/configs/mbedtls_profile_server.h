@@ -0,0 +1,63 @@
+/*
+ * MBEDTLS_CONFIG_PROFILE=server
+ *
+ * A TLS 1.2 server for gateways that hold many sessions. Clients may send
+ * full 16 KB records unless they negotiate a smaller maximum fragment
+ * length, so the input buffer stays at 16 KB; the server itself sends
+ * records of at most 4 KB. This file is appended to mbedtls_config.h by
+ * mbedtls.cmake.
+ */
+
+/* Server only, no DTLS */
+#undef MBEDTLS_SSL_CLI_C
+#undef MBEDTLS_SSL_PROTO_DTLS
+#undef MBEDTLS_SSL_DTLS_ANTI_REPLAY
+#undef MBEDTLS_SSL_DTLS_HELLO_VERIFY
+#undef MBEDTLS_SSL_DTLS_CLIENT_PORT_REUSE
+#undef MBEDTLS_SSL_DTLS_CONNECTION_ID
+#undef MBEDTLS_SSL_DTLS_SRTP
+#undef MBEDTLS_SSL_COOKIE_C
+
+/* TLS 1.2 only; mbedTLS 3.6 enables TLS 1.3 by default and no TLS 1.3
+ * suite is listed below. */
+#undef MBEDTLS_SSL_PROTO_TLS1_3
+#undef MBEDTLS_SSL_TLS1_3_COMPATIBILITY_MODE
+#undef MBEDTLS_SSL_EARLY_DATA
+#undef MBEDTLS_SSL_RECORD_SIZE_LIMIT
+
+/* Forward-secret ECDHE key exchange only */
+#undef MBEDTLS_KEY_EXCHANGE_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_DHE_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDHE_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_RSA_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_DHE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDH_ECDSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDH_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECJPAKE_ENABLED
+#undef MBEDTLS_DHM_C
+
+#undef MBEDTLS_SSL_CIPHERSUITES
+#define MBEDTLS_SSL_CIPHERSUITES                              \
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,          \
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,            \
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,          \
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,            \
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,    \
+    MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+
+/* Record buffers. MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH is left off: it
+ * reallocates the buffers after every handshake and session reset, which
+ * fragments a fixed arena and breaks the pool's fixed footprint. */
+#undef MBEDTLS_SSL_IN_CONTENT_LEN
+#define MBEDTLS_SSL_IN_CONTENT_LEN 16384
+#undef MBEDTLS_SSL_OUT_CONTENT_LEN
+#define MBEDTLS_SSL_OUT_CONTENT_LEN 4096
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+
+/* Client certificates are not requested, so nothing is kept per session. */
+#undef MBEDTLS_SSL_KEEP_PEER_CERTIFICATE
+
+/* See mbedtls_profile_full.h */
+#define MBEDTLS_PLATFORM_MEMORY
+#define MBEDTLS_MEMORY_BUFFER_ALLOC_C
@@ -1,18 +1,176 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "mbedtls/build_info.h"
 #include "mbedtls/net_sockets.h"
 #include "mbedtls/ssl.h"
 #include "mbedtls/entropy.h"
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/error.h"
 #include "mbedtls/debug.h"
+#ifndef _WIN32
+#include "tls_loadgen.h"
+#endif
 
 #define VERIFY_CERTIFICATE 0
 #define BUFFER_SIZE 2048
 
+// 수신 버퍼를 줄인 설정(tiny-client 프로필 등)에서는 서버에 그보다 작은 레코드를 요청
+static int conf_max_frag_len(mbedtls_ssl_config *conf) {
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH) && MBEDTLS_SSL_IN_CONTENT_LEN < 16384
+    unsigned char mfl = MBEDTLS_SSL_IN_CONTENT_LEN >= 4096 ? MBEDTLS_SSL_MAX_FRAG_LEN_4096 :
+                        MBEDTLS_SSL_IN_CONTENT_LEN >= 2048 ? MBEDTLS_SSL_MAX_FRAG_LEN_2048 :
+                        MBEDTLS_SSL_IN_CONTENT_LEN >= 1024 ? MBEDTLS_SSL_MAX_FRAG_LEN_1024 :
+                                                             MBEDTLS_SSL_MAX_FRAG_LEN_512;
+    return mbedtls_ssl_conf_max_frag_len(conf, mfl);
+#else
+    (void)conf;
+    return 0;
+#endif
+}
+
+#ifndef _WIN32
+/* 부하 생성기 백엔드: 스레드마다 RNG와 설정을 하나씩, 연결마다 SSL 컨텍스트를 하나씩 사용 */
+struct loadgen_ctx {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_ssl_config conf;
+};
+
+struct loadgen_conn {
+    mbedtls_ssl_context ssl;
+    mbedtls_net_context net;
+};
+
+static void loadgen_ctx_free(void *arg) {
+    struct loadgen_ctx *ctx = arg;
+    mbedtls_ssl_config_free(&ctx->conf);
+    mbedtls_ctr_drbg_free(&ctx->ctr_drbg);
+    mbedtls_entropy_free(&ctx->entropy);
+    free(ctx);
+}
+
+static void *loadgen_ctx_new(void) {
+    struct loadgen_ctx *ctx = calloc(1, sizeof(*ctx));
+    const char *pers = "ssl_client_loadgen";
+    if (!ctx) return NULL;
+
+    mbedtls_entropy_init(&ctx->entropy);
+    mbedtls_ctr_drbg_init(&ctx->ctr_drbg);
+    mbedtls_ssl_config_init(&ctx->conf);
+    if (mbedtls_ctr_drbg_seed(&ctx->ctr_drbg, mbedtls_entropy_func, &ctx->entropy,
+                              (const unsigned char *)pers, strlen(pers)) != 0 ||
+        mbedtls_ssl_config_defaults(&ctx->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0 ||
+        conf_max_frag_len(&ctx->conf) != 0) {
+        loadgen_ctx_free(ctx);
+        return NULL;
+    }
+    mbedtls_ssl_conf_rng(&ctx->conf, mbedtls_ctr_drbg_random, &ctx->ctr_drbg);
+    mbedtls_ssl_conf_authmode(&ctx->conf, MBEDTLS_SSL_VERIFY_NONE);
+    return ctx;
+}
+
+static void loadgen_conn_free(void *arg) {
+    struct loadgen_conn *conn = arg;
+    // 소켓은 부하 생성기가 닫으므로 mbedtls_net_free는 호출하지 않음
+    mbedtls_ssl_close_notify(&conn->ssl);
+    mbedtls_ssl_free(&conn->ssl);
+    free(conn);
+}
+
+static void *loadgen_conn_new(void *arg, int fd, const char *host, void *session) {
+    struct loadgen_ctx *ctx = arg;
+    struct loadgen_conn *conn = calloc(1, sizeof(*conn));
+    if (!conn) return NULL;
+
+    mbedtls_ssl_init(&conn->ssl);
+    conn->net.fd = fd;
+    if (mbedtls_ssl_setup(&conn->ssl, &ctx->conf) != 0 ||
+        mbedtls_ssl_set_hostname(&conn->ssl, host) != 0 ||
+        (session && mbedtls_ssl_set_session(&conn->ssl, session) != 0)) {
+        mbedtls_ssl_free(&conn->ssl);
+        free(conn);
+        return NULL;
+    }
+    mbedtls_ssl_set_bio(&conn->ssl, &conn->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+    return conn;
+}
+
+static int loadgen_result(int ret) {
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ) return TLS_LOADGEN_WANT_READ;
+    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) return TLS_LOADGEN_WANT_WRITE;
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY || ret == 0) return TLS_LOADGEN_CLOSED;
+    return TLS_LOADGEN_ERROR;
+}
+
+static int loadgen_handshake(void *arg) {
+    struct loadgen_conn *conn = arg;
+    int ret = mbedtls_ssl_handshake(&conn->ssl);
+    return ret == 0 ? 0 : loadgen_result(ret);
+}
+
+static int loadgen_read(void *arg, unsigned char *buf, size_t len) {
+    struct loadgen_conn *conn = arg;
+    int ret = mbedtls_ssl_read(&conn->ssl, buf, len);
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+    // TLS 1.3 세션 티켓은 데이터가 아니므로 다시 읽음
+    while (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+        ret = mbedtls_ssl_read(&conn->ssl, buf, len);
+    }
+#endif
+    return ret > 0 ? ret : loadgen_result(ret);
+}
+
+static int loadgen_write(void *arg, const unsigned char *buf, size_t len) {
+    struct loadgen_conn *conn = arg;
+    int ret = mbedtls_ssl_write(&conn->ssl, buf, len);
+    return ret > 0 ? ret : loadgen_result(ret);
+}
+
+static void *loadgen_session_get(void *arg) {
+    struct loadgen_conn *conn = arg;
+    mbedtls_ssl_session *session = malloc(sizeof(*session));
+    if (!session) return NULL;
+    mbedtls_ssl_session_init(session);
+    if (mbedtls_ssl_get_session(&conn->ssl, session) != 0) {
+        mbedtls_ssl_session_free(session);
+        free(session);
+        return NULL;
+    }
+    return session;
+}
+
+static void loadgen_session_free(void *session) {
+    mbedtls_ssl_session_free(session);
+    free(session);
+}
+
+// mbedTLS는 재개 여부를 알려주는 공개 API가 없으므로 resumed는 NULL
+static const struct tls_loadgen_backend loadgen_backend = {
+    "Mbed TLS " MBEDTLS_VERSION_STRING,
+    loadgen_ctx_new,
+    loadgen_ctx_free,
+    loadgen_conn_new,
+    loadgen_conn_free,
+    loadgen_handshake,
+    loadgen_read,
+    loadgen_write,
+    NULL,
+    loadgen_session_get,
+    loadgen_session_free,
+};
+#endif
+
 int main(int argc, char *argv[]) {
+#ifndef _WIN32
+    if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+        return tls_loadgen_main(&loadgen_backend, argc - 1, argv + 1);
+    }
+#endif
     if (argc != 4) {
         fprintf(stderr, "Usage: %s <hostname> <port> <message>\n", argv[0]);
+        fprintf(stderr, "       %s -l [-c connections] [-t threads] [-d seconds] [-s size] <hostname> <port>\n", argv[0]);
         return 1;
     }
 
@@ -49,6 +207,11 @@ int main(int argc, char *argv[]) {
 
     mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
 
+    if ((ret = conf_max_frag_len(&conf)) != 0) {
+        fprintf(stderr, "mbedtls_ssl_conf_max_frag_len failed: %d\n", ret);
+        goto cleanup;
+    }
+
 #if VERIFY_CERTIFICATE
     mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
 #else
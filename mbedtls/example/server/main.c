@@ -2,9 +2,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "mbedtls/net_sockets.h"
 #include "mbedtls/ssl.h"
 #include "mbedtls/entropy.h"
@@ -13,10 +19,61 @@
 #include "mbedtls/x509.h"
 #include "mbedtls/x509_crt.h"
 #include "mbedtls/pk.h"
+#include "mbedtls/pem.h"
+#include "mbedtls/platform.h"
+#include "mbedtls/platform_util.h"
+#if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+#include "mbedtls/memory_buffer_alloc.h"
+#endif
 
-#define BUFFER_SIZE 2048
+/* Plaintext echoed per read; the rest of a record stays in the SSL
+ * context until the next read. */
+#define BUFFER_SIZE 4096
+#define PEM_BUFFER_SIZE 16000
+#define DEFAULT_MAX_CONNECTIONS 32
+/* Reads echoed per wakeup before yielding to other connections. */
+#define MAX_READS_PER_EVENT 16
 
-static int generate_self_signed_cert(mbedtls_x509_crt *cert, mbedtls_pk_context *key) {
+#if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+/* Default arena: the certificate, key and RNG, plus record buffers and a
+ * handshake in progress for every connection. Override with -a. */
+#define ARENA_BASE_SIZE (256 * 1024)
+#define ARENA_CONN_SIZE (64 * 1024)
+#define OPTIONS "k:c:p:vm:a:"
+#else
+#define OPTIONS "k:c:p:vm:"
+#endif
+
+static volatile sig_atomic_t stop_requested;
+/* Most clients served at once, for the arena report */
+static int peak_busy;
+
+/* mbedTLS has no Ed25519 certificates; RSA and ECDSA P-256 are offered. */
+enum key_type {
+    KEY_RSA2048,
+    KEY_RSA3072,
+    KEY_P256
+};
+
+static int parse_key_type(const char *name, enum key_type *type) {
+    if (strcmp(name, "rsa2048") == 0) {
+        *type = KEY_RSA2048;
+    } else if (strcmp(name, "rsa3072") == 0) {
+        *type = KEY_RSA3072;
+    } else if (strcmp(name, "p256") == 0) {
+        *type = KEY_P256;
+    } else {
+        if (strcmp(name, "ed25519") == 0) {
+            fprintf(stderr, "Ed25519 certificates are not supported by mbedTLS\n");
+        } else {
+            fprintf(stderr, "Unknown key type '%s'\n", name);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static int generate_self_signed_cert(mbedtls_x509_crt *cert, mbedtls_pk_context *key, enum key_type type) {
    int ret;
    mbedtls_x509write_cert crt;
    mbedtls_entropy_context entropy;
@@ -49,13 +106,24 @@ static int generate_self_signed_cert(mbedtls_x509_crt *cert, mbedtls_pk_context
        goto exit;
    }
    
-   if ((ret = mbedtls_pk_setup(key, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA))) != 0) {
-       goto exit;
-   }
-   
-   if ((ret = mbedtls_rsa_gen_key(mbedtls_pk_rsa(*key), mbedtls_ctr_drbg_random, &ctr_drbg,
-                                 2048, 65537)) != 0) {
-       goto exit;
+   if (type == KEY_P256) {
+       if ((ret = mbedtls_pk_setup(key, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY))) != 0) {
+           goto exit;
+       }
+       
+       if ((ret = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(*key),
+                                      mbedtls_ctr_drbg_random, &ctr_drbg)) != 0) {
+           goto exit;
+       }
+   } else {
+       if ((ret = mbedtls_pk_setup(key, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA))) != 0) {
+           goto exit;
+       }
+       
+       if ((ret = mbedtls_rsa_gen_key(mbedtls_pk_rsa(*key), mbedtls_ctr_drbg_random, &ctr_drbg,
+                                     type == KEY_RSA3072 ? 3072 : 2048, 65537)) != 0) {
+           goto exit;
+       }
    }
    
    mbedtls_x509write_crt_set_subject_key(&crt, key);
@@ -85,9 +153,10 @@ static int generate_self_signed_cert(mbedtls_x509_crt *cert, mbedtls_pk_context
        goto exit;
    }
    
+   /* ECDSA keys only sign; RSA keys may also be used for RSA key exchange. */
    if ((ret = mbedtls_x509write_crt_set_key_usage(&crt, 
-           MBEDTLS_X509_KU_DIGITAL_SIGNATURE |
-           MBEDTLS_X509_KU_KEY_ENCIPHERMENT)) != 0) {
+           type == KEY_P256 ? MBEDTLS_X509_KU_DIGITAL_SIGNATURE :
+           MBEDTLS_X509_KU_DIGITAL_SIGNATURE | MBEDTLS_X509_KU_KEY_ENCIPHERMENT)) != 0) {
        goto exit;
    }
    
@@ -110,6 +179,62 @@ exit:
    return ret;
 }
 
+static int write_file(const char *path, const unsigned char *data, size_t len, mode_t mode) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    int ok = write(fd, data, len) == (ssize_t)len;
+    if (close(fd) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* Writes the generated certificate and key as PEM so later starts can load
+ * them. The key file is created readable by the owner only. */
+static int save_cert(const char *cert_file, const char *key_file,
+                     const mbedtls_x509_crt *cert, mbedtls_pk_context *key) {
+    unsigned char buf[PEM_BUFFER_SIZE];
+    size_t len;
+    int ret;
+    
+    if ((ret = mbedtls_pk_write_key_pem(key, buf, sizeof(buf))) != 0) {
+        return ret;
+    }
+    ret = write_file(key_file, buf, strlen((char *)buf), 0600);
+    if (ret == 0) {
+        ret = mbedtls_pem_write_buffer("-----BEGIN CERTIFICATE-----\n", "-----END CERTIFICATE-----\n",
+                                       cert->raw.p, cert->raw.len, buf, sizeof(buf), &len);
+    }
+    if (ret == 0) {
+        /* len includes the terminating NUL. */
+        ret = write_file(cert_file, buf, len - 1, 0644);
+    }
+    mbedtls_platform_zeroize(buf, sizeof(buf));
+    return ret;
+}
+
+/* Loads the certificate and key from disk. If neither file exists yet, a
+ * certificate of the given type is generated and written there first. */
+static int load_cert(const char *cert_file, const char *key_file, enum key_type type,
+                     mbedtls_x509_crt *cert, mbedtls_pk_context *key, mbedtls_ctr_drbg_context *ctr_drbg) {
+    int ret;
+    
+    if (access(cert_file, F_OK) != 0 && access(key_file, F_OK) != 0) {
+        if ((ret = generate_self_signed_cert(cert, key, type)) != 0 ||
+            (ret = save_cert(cert_file, key_file, cert, key)) != 0) {
+            return ret;
+        }
+        printf("Generated %s and %s\n", cert_file, key_file);
+        return 0;
+    }
+    
+    if ((ret = mbedtls_x509_crt_parse_file(cert, cert_file)) != 0) {
+        return ret;
+    }
+    return mbedtls_pk_parse_keyfile(key, key_file, NULL, mbedtls_ctr_drbg_random, ctr_drbg);
+}
+
 static int create_socket(int port) {
     int sockfd;
     struct sockaddr_in addr;
@@ -138,7 +263,7 @@ static int create_socket(int port) {
         return -1;
     }
     
-    if (listen(sockfd, 5) < 0) {
+    if (listen(sockfd, SOMAXCONN) < 0) {
         perror("listen");
         close(sockfd);
         return -1;
@@ -147,21 +272,288 @@ static int create_socket(int port) {
     return sockfd;
 }
 
+/* A slot in the connection pool. Its SSL context is set up once at
+ * startup and reset between clients, so accepting a client allocates
+ * nothing. */
+struct conn {
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    int in_use;
+    int handshake_done;
+    size_t pending;
+    size_t written;
+    unsigned char buf[BUFFER_SIZE];
+};
+
+static int setup_pool(struct conn *pool, int count, const mbedtls_ssl_config *conf) {
+    int ret;
+
+    for (int i = 0; i < count; i++) {
+        mbedtls_net_init(&pool[i].net);
+        mbedtls_ssl_init(&pool[i].ssl);
+    }
+    for (int i = 0; i < count; i++) {
+        if ((ret = mbedtls_ssl_setup(&pool[i].ssl, conf)) != 0) {
+            printf("Failed to setup SSL: %d\n", ret);
+            return ret;
+        }
+        mbedtls_ssl_set_bio(&pool[i].ssl, &pool[i].net, mbedtls_net_send, mbedtls_net_recv, NULL);
+    }
+    return 0;
+}
+
+static void free_pool(struct conn *pool, int count) {
+    for (int i = 0; i < count; i++) {
+        mbedtls_net_free(&pool[i].net);
+        mbedtls_ssl_free(&pool[i].ssl);
+    }
+}
+
+static void close_conn(struct conn *c) {
+    mbedtls_net_free(&c->net);
+    mbedtls_ssl_session_reset(&c->ssl);
+    c->in_use = 0;
+    c->handshake_done = 0;
+    c->pending = 0;
+    c->written = 0;
+}
+
+/* Maps an mbedTLS result to the poll events it waits for; 0 to close. */
+static short want_events(struct conn *c, int ret) {
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ) return POLLIN;
+    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) return POLLOUT;
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        /* Best effort; the socket is non-blocking. */
+        mbedtls_ssl_close_notify(&c->ssl);
+    } else if (ret != 0 && ret != MBEDTLS_ERR_NET_CONN_RESET) {
+        char error_buf[100];
+        mbedtls_strerror(ret, error_buf, sizeof(error_buf));
+        printf("Connection failed: %s\n", error_buf);
+    }
+    return 0;
+}
+
+/* Advances the connection as far as it goes without blocking: finishes
+ * the handshake, then echoes until the socket runs dry. Returns the events
+ * to poll for next, or 0 to close. */
+static short conn_step(struct conn *c, int verbose) {
+    int ret;
+
+    if (!c->handshake_done) {
+        ret = mbedtls_ssl_handshake(&c->ssl);
+        if (ret != 0) return want_events(c, ret);
+        c->handshake_done = 1;
+    }
+
+    for (int reads = 0; reads < MAX_READS_PER_EVENT; reads++) {
+        while (c->written < c->pending) {
+            ret = mbedtls_ssl_write(&c->ssl, c->buf + c->written, c->pending - c->written);
+            if (ret <= 0) return want_events(c, ret);
+            c->written += (size_t)ret;
+        }
+
+        ret = mbedtls_ssl_read(&c->ssl, c->buf, sizeof(c->buf));
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+        if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) continue;
+#endif
+        if (ret <= 0) return want_events(c, ret);
+        if (verbose) {
+            printf("Received: %.*s", ret, (char *)c->buf);
+        }
+        c->pending = (size_t)ret;
+        c->written = 0;
+    }
+    return POLLIN | POLLOUT;
+}
+
+/* Plaintext already decrypted into the context is invisible to poll(), so
+ * such a connection is stepped without waiting, unless it is blocked on a
+ * write. */
+static int has_buffered_input(struct conn *c) {
+    return c->in_use && c->handshake_done && c->written >= c->pending &&
+           mbedtls_ssl_get_bytes_avail(&c->ssl) > 0;
+}
+
+static void accept_conns(int sockfd, struct conn *pool, int count, struct pollfd *fds) {
+    for (int i = 0; i < count; i++) {
+        if (pool[i].in_use) continue;
+
+        int client_fd = accept(sockfd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+            return;
+        }
+        /* Small handshake and echo writes must not wait on delayed ACKs. */
+        int one = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pool[i].net.fd = client_fd;
+        if (mbedtls_net_set_nonblock(&pool[i].net) != 0) {
+            perror("fcntl");
+            mbedtls_net_free(&pool[i].net);
+            continue;
+        }
+        pool[i].in_use = 1;
+        fds[i + 1].fd = client_fd;
+        fds[i + 1].events = POLLIN;
+    }
+}
+
+/* Serves up to count clients from one thread with poll(). Slot 0 of the
+ * poll set is the listener, which is left out while the pool is full so
+ * that further clients wait in the backlog. */
+static int serve(int sockfd, struct conn *pool, int count, int verbose) {
+    struct pollfd *fds = calloc((size_t)count + 1, sizeof(struct pollfd));
+    int ret = 0;
+
+    if (!fds) return -1;
+    fds[0].fd = sockfd;
+    fds[0].events = POLLIN;
+    for (int i = 0; i < count; i++) {
+        fds[i + 1].fd = -1;
+    }
+
+    while (!stop_requested) {
+        int busy = 0;
+        int timeout = -1;
+        for (int i = 0; i < count; i++) {
+            busy += pool[i].in_use;
+            if (has_buffered_input(&pool[i])) timeout = 0;
+        }
+        if (busy > peak_busy) peak_busy = busy;
+        fds[0].fd = busy < count ? sockfd : -1;
+
+        if (poll(fds, (nfds_t)count + 1, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            struct conn *c = &pool[i];
+            struct pollfd *pfd = &fds[i + 1];
+            if (!c->in_use || (!pfd->revents && !has_buffered_input(c))) continue;
+
+            short want = conn_step(c, verbose);
+            if (want == 0) {
+                close_conn(c);
+                pfd->fd = -1;
+            }
+            pfd->events = want;
+            pfd->revents = 0;
+        }
+        if (fds[0].fd >= 0 && fds[0].revents) {
+            accept_conns(sockfd, pool, count, fds);
+        }
+    }
+
+    free(fds);
+    return ret;
+}
+
+static void request_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+#if defined(MBEDTLS_MEMORY_DEBUG)
+static size_t arena_used(void) {
+    size_t used, blocks;
+
+    mbedtls_memory_buffer_alloc_cur_get(&used, &blocks);
+    return used;
+}
+#endif
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-v] [-m connections] [-k type] [-c cert.pem -p key.pem] <port>\n", prog);
+    fprintf(stderr, "  -v       print received data\n");
+    fprintf(stderr, "  -m n     concurrent connections, each with a preallocated SSL context (default %d)\n",
+            DEFAULT_MAX_CONNECTIONS);
+#if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+    fprintf(stderr, "  -a kb    size of the memory arena mbedTLS allocates from (default %d + %d per connection)\n",
+            ARENA_BASE_SIZE / 1024, ARENA_CONN_SIZE / 1024);
+#endif
+    fprintf(stderr, "  -k type  certificate key: rsa2048 (default), rsa3072 or p256\n");
+    fprintf(stderr, "  -c -p    load the certificate and key from these files, generating\n");
+    fprintf(stderr, "           them with -k first if neither exists\n");
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    enum key_type key_type = KEY_RSA2048;
+    const char *cert_file = NULL;
+    const char *key_file = NULL;
+    int verbose = 0;
+    int max_conns = DEFAULT_MAX_CONNECTIONS;
+#if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+    size_t arena_size = 0;
+#endif
+    int opt;
+    
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'm':
+            max_conns = atoi(optarg);
+            if (max_conns < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+#if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+        case 'a':
+            arena_size = (size_t)strtoul(optarg, NULL, 10) * 1024;
+            if (arena_size == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+#endif
+        case 'k':
+            if (parse_key_type(optarg, &key_type) != 0) return 1;
+            break;
+        case 'c':
+            cert_file = optarg;
+            break;
+        case 'p':
+            key_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || (!cert_file != !key_file)) {
+        usage(argv[0]);
         return 1;
     }
     
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
     if (port <= 0 || port > 65535) {
         fprintf(stderr, "Invalid port number\n");
         return 1;
     }
     
+#if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+    /* Every mbedTLS allocation from here on comes out of this one block. */
+    if (arena_size == 0) arena_size = ARENA_BASE_SIZE + (size_t)max_conns * ARENA_CONN_SIZE;
+    unsigned char *arena = malloc(arena_size);
+    if (!arena) {
+        fprintf(stderr, "Cannot allocate a %zu byte arena\n", arena_size);
+        return 1;
+    }
+    mbedtls_memory_buffer_alloc_init(arena, arena_size);
+#endif
+#if defined(MBEDTLS_MEMORY_DEBUG)
+    size_t pool_used = 0;
+    size_t idle_per_conn = 0;
+#endif
+    
     int ret = 1;
     int sockfd = -1;
-    mbedtls_ssl_context ssl;
+    struct conn *pool = NULL;
     mbedtls_ssl_config conf;
     mbedtls_x509_crt srvcert;
     mbedtls_pk_context pkey;
@@ -169,7 +561,6 @@ int main(int argc, char **argv) {
     mbedtls_ctr_drbg_context ctr_drbg;
     const char *pers = "ssl_server";
     
-    mbedtls_ssl_init(&ssl);
     mbedtls_ssl_config_init(&conf);
     mbedtls_x509_crt_init(&srvcert);
     mbedtls_pk_init(&pkey);
@@ -182,7 +573,12 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
     
-    if ((ret = generate_self_signed_cert(&srvcert, &pkey)) != 0) {
+    if (cert_file) {
+        if ((ret = load_cert(cert_file, key_file, key_type, &srvcert, &pkey, &ctr_drbg)) != 0) {
+            printf("Failed to load certificate: %d\n", ret);
+            goto cleanup;
+        }
+    } else if ((ret = generate_self_signed_cert(&srvcert, &pkey, key_type)) != 0) {
         printf("Failed to generate certificate: %d\n", ret);
         goto cleanup;
     }
@@ -202,67 +598,76 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
     
+#if defined(MBEDTLS_MEMORY_DEBUG)
+    pool_used = arena_used();
+#endif
+    pool = mbedtls_calloc((size_t)max_conns, sizeof(struct conn));
+    if (!pool) {
+        printf("Cannot allocate %d connections\n", max_conns);
+        ret = 1;
+        goto cleanup;
+    }
+    if ((ret = setup_pool(pool, max_conns, &conf)) != 0) goto cleanup;
+#if defined(MBEDTLS_MEMORY_DEBUG)
+    /* An idle slot holds its record buffers; handshakes and open sessions
+     * add to that, which the peak reported on exit shows. */
+    idle_per_conn = (arena_used() - pool_used) / (size_t)max_conns;
+    pool_used = arena_used();
+    mbedtls_memory_buffer_alloc_max_reset();
+    printf("Arena: %zu of %zu bytes in use, %zu bytes per idle connection\n",
+           pool_used, arena_size, idle_per_conn);
+#endif
+    
     sockfd = create_socket(port);
-    if (sockfd < 0) goto cleanup;
+    if (sockfd < 0 || fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) < 0) {
+        ret = 1;
+        goto cleanup;
+    }
+    signal(SIGPIPE, SIG_IGN);
     
-    printf("Server listening on port %d\n", port);
+    /* Without SA_RESTART, poll() returns on SIGINT/SIGTERM and the server
+     * shuts down cleanly. */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
     
-    while(1) {
-        struct sockaddr_in client_addr;
-        unsigned int client_len = sizeof(client_addr);
-        int client_fd;
-        unsigned char buf[BUFFER_SIZE];
-        
-        client_fd = accept(sockfd, (struct sockaddr*)&client_addr, &client_len);
-        if (client_fd < 0) {
-            perror("accept");
-            continue;
-        }
-        
-        if ((ret = mbedtls_ssl_setup(&ssl, &conf)) != 0) {
-            printf("Failed to setup SSL: %d\n", ret);
-            close(client_fd);
-            continue;
-        }
-        
-        mbedtls_ssl_set_bio(&ssl, &client_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
-        
-        while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
-            if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-                printf("Failed to perform SSL handshake: %d\n", ret);
-                break;
-            }
-        }
-        
-        if (ret == 0) {
-            int len = mbedtls_ssl_read(&ssl, buf, sizeof(buf) - 1);
-            if (len > 0) {
-                buf[len] = '\0';
-                printf("Received: %s", (char *)buf);
-                mbedtls_ssl_write(&ssl, buf, len);
-            }
-        }
-        
-        mbedtls_ssl_session_reset(&ssl);
-        close(client_fd);
-    }
+    printf("Server listening on port %d, up to %d connections\n", port, max_conns);
+    fflush(stdout);
     
-    ret = 0;
+    ret = serve(sockfd, pool, max_conns, verbose) == 0 ? 0 : 1;
+    
+#if defined(MBEDTLS_MEMORY_DEBUG)
+    if (peak_busy > 0) {
+        size_t max_used, max_blocks;
+        mbedtls_memory_buffer_alloc_max_get(&max_used, &max_blocks);
+        printf("Arena peak: %zu bytes with %d clients, about %zu bytes per busy connection\n",
+               max_used, peak_busy, idle_per_conn + (max_used - pool_used) / (size_t)peak_busy);
+    }
+#endif
     
 cleanup:
-    if (ret != 0) {
+    if (ret < 0) {
         char error_buf[100];
         mbedtls_strerror(ret, error_buf, sizeof(error_buf));
         printf("Error: %s\n", error_buf);
     }
     
     if (sockfd >= 0) close(sockfd);
-    mbedtls_ssl_free(&ssl);
+    if (pool) {
+        free_pool(pool, max_conns);
+        mbedtls_free(pool);
+    }
     mbedtls_ssl_config_free(&conf);
     mbedtls_x509_crt_free(&srvcert);
     mbedtls_pk_free(&pkey);
     mbedtls_entropy_free(&entropy);
     mbedtls_ctr_drbg_free(&ctr_drbg);
+#if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+    mbedtls_memory_buffer_alloc_free();
+    free(arena);
+#endif
     
     return ret;
 }
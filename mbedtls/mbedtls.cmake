@@ -7,6 +7,9 @@ include(ProcessorCount)
 
 option(USE_SHARED "Use shared libraries" OFF)
 option(USE_SYSTEM "Use libraries installed in system" OFF)
+set(MBEDTLS_CONFIG_PROFILE "" CACHE STRING "Configuration profile applied when building MbedTLS from source (tiny-client, server, full)")
+set_property(CACHE MBEDTLS_CONFIG_PROFILE PROPERTY STRINGS "" tiny-client server full)
+option(MBEDTLS_MEMORY_DEBUG "Add arena usage counters to a MBEDTLS_CONFIG_PROFILE build" OFF)
 
 add_library(mbedtls INTERFACE)
 
@@ -220,6 +223,29 @@ elseif(DEFINED MBEDTLS_DIR AND EXISTS ${MBEDTLS_DIR})
   
   file(MAKE_DIRECTORY ${MBEDTLS_INCLUDE_DIR})
 
+  # The profile is appended to the extracted mbedtls_config.h rather than
+  # passed as MBEDTLS_USER_CONFIG_FILE, so the installed headers that the
+  # application compiles against match the library.
+  if(MBEDTLS_CONFIG_PROFILE)
+    set(MBEDTLS_PROFILE_NAME "mbedtls_profile_${MBEDTLS_CONFIG_PROFILE}.h")
+    if(NOT EXISTS "${CMAKE_CURRENT_LIST_DIR}/configs/${MBEDTLS_PROFILE_NAME}")
+      message(FATAL_ERROR "Unknown MBEDTLS_CONFIG_PROFILE: ${MBEDTLS_CONFIG_PROFILE}")
+    endif()
+    file(COPY "${CMAKE_CURRENT_LIST_DIR}/configs/${MBEDTLS_PROFILE_NAME}"
+      DESTINATION "${MBEDTLS_SOURCE_PATH}/include/mbedtls"
+    )
+    file(APPEND "${MBEDTLS_SOURCE_PATH}/include/mbedtls/mbedtls_config.h"
+      "\n#include \"${MBEDTLS_PROFILE_NAME}\"\n"
+    )
+    # Usage counters cost a header per allocation, so they are opt-in.
+    if(MBEDTLS_MEMORY_DEBUG)
+      file(APPEND "${MBEDTLS_SOURCE_PATH}/include/mbedtls/mbedtls_config.h"
+        "#define MBEDTLS_MEMORY_DEBUG\n"
+      )
+    endif()
+    message(STATUS "MbedTLS config profile: ${MBEDTLS_CONFIG_PROFILE}")
+  endif()
+
   set(EXTRA_CMAKE_ARGS "")
   if(DEFINED CMAKE_TOOLCHAIN_FILE)
     list(APPEND EXTRA_CMAKE_ARGS "-DCMAKE_TOOLCHAIN_FILE=${CMAKE_TOOLCHAIN_FILE}")
@@ -245,6 +271,32 @@ elseif(DEFINED MBEDTLS_DIR AND EXISTS ${MBEDTLS_DIR})
     LOG_INSTALL TRUE
   )
   
+  # Print the code size of the installed libraries after every build, so
+  # each MBEDTLS_CONFIG_PROFILE can be compared. A cross toolchain's size
+  # tool sits next to its archiver.
+  get_filename_component(MBEDTLS_AR_DIR "${CMAKE_AR}" DIRECTORY)
+  get_filename_component(MBEDTLS_AR_NAME "${CMAKE_AR}" NAME_WE)
+  string(REGEX REPLACE "ar$" "size" MBEDTLS_SIZE_NAME "${MBEDTLS_AR_NAME}")
+  find_program(MBEDTLS_SIZE_TOOL
+    NAMES ${MBEDTLS_SIZE_NAME} size llvm-size
+    HINTS "${MBEDTLS_AR_DIR}"
+  )
+  if(MBEDTLS_SIZE_TOOL)
+    if(MBEDTLS_CONFIG_PROFILE)
+      set(MBEDTLS_SIZE_LABEL "${MBEDTLS_CONFIG_PROFILE}")
+    else()
+      set(MBEDTLS_SIZE_LABEL "default")
+    endif()
+    ExternalProject_Add_Step(mbedtls_build size
+      COMMAND ${CMAKE_COMMAND} -E echo "MbedTLS code size (profile: ${MBEDTLS_SIZE_LABEL}):"
+      COMMAND ${MBEDTLS_SIZE_TOOL} -t
+        "${MBEDTLS_LIB_DIR}/${MBEDTLS_LIB_NAME}"
+        "${MBEDTLS_LIB_DIR}/${MBEDX509_LIB_NAME}"
+        "${MBEDTLS_LIB_DIR}/${MBEDCRYPTO_LIB_NAME}"
+      DEPENDEES install
+    )
+  endif()
+
   add_dependencies(mbedtls mbedtls_build)
   
   include_directories(${MBEDTLS_INCLUDE_DIR})
@@ -282,5 +334,9 @@ else()
   message(FATAL_ERROR "Failed to build/load MbedTLS")
 endif()
 
+if(MBEDTLS_CONFIG_PROFILE AND NOT DEFINED MBEDTLS_SOURCE_PATH)
+  message(WARNING "MBEDTLS_CONFIG_PROFILE only applies when building MbedTLS from MBEDTLS_DIR")
+endif()
+
 message(STATUS "Include directory: ${MBEDTLS_INCLUDE_DIR}")
 message(STATUS "Library directory: ${MBEDTLS_LIB_DIR}")
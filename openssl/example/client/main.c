@@ -1,43 +1,25 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/opensslv.h>
+#ifndef _WIN32
+#include "tls_loadgen.h"
+#endif
 
 #define VERIFY_CERTIFICATE 0
 #define BUFFER_SIZE 2048
 
-int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <hostname> <port> <message>\n", argv[0]);
-        return 1;
-    }
-
-    int ret = 1;
+/* Connects, sends msg and reads the echo. A session from an earlier
+ * connection is offered for resumption and replaced by the new one. */
+static int echo_once(SSL_CTX *ctx, const char *host, const char *host_port, const char *msg,
+                     SSL_SESSION **session, int *reused, int print) {
+    int ret = -1;
     BIO *bio = NULL;
-    SSL_CTX *ctx = NULL;
     SSL *ssl = NULL;
     char buf[BUFFER_SIZE];
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-    SSL_library_init();
-    SSL_load_error_strings();
-#else
-    OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, NULL);
-#endif
-
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-    ctx = SSL_CTX_new(SSLv23_client_method());
-#else
-    ctx = SSL_CTX_new(TLS_client_method());
-#endif
-    if (!ctx) {
-        fprintf(stderr, "SSL_CTX_new failed\n");
-        goto cleanup;
-    }
-
-    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
-
     bio = BIO_new_ssl_connect(ctx);
     if (!bio) {
         fprintf(stderr, "BIO_new_ssl_connect failed\n");
@@ -50,20 +32,23 @@ int main(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    char host_port[256];
-    snprintf(host_port, sizeof(host_port), "%s:%s", argv[1], argv[2]);
     BIO_set_conn_hostname(bio, host_port);
 
 #if VERIFY_CERTIFICATE
     #if OPENSSL_VERSION_NUMBER >= 0x10002000L
         X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
-        X509_VERIFY_PARAM_set1_host(param, argv[1], 0);
+        X509_VERIFY_PARAM_set1_host(param, host, 0);
         SSL_set_verify(ssl, SSL_VERIFY_PEER, NULL);
     #endif
 #else
+    (void)host;
     SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
 #endif
 
+    if (*session) {
+        SSL_set_session(ssl, *session);
+    }
+
     if (BIO_do_connect(bio) <= 0) {
         fprintf(stderr, "BIO_do_connect failed\n");
         goto cleanup;
@@ -73,8 +58,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "BIO_do_handshake failed\n");
         goto cleanup;
     }
+    *reused = SSL_session_reused(ssl);
 
-    if (BIO_puts(bio, argv[3]) <= 0) {
+    if (BIO_puts(bio, msg) <= 0) {
         fprintf(stderr, "BIO_puts failed\n");
         goto cleanup;
     }
@@ -82,15 +68,184 @@ int main(int argc, char *argv[]) {
     int len = BIO_read(bio, buf, sizeof(buf)-1);
     if (len > 0) {
         buf[len] = '\0';
-        printf("Received: %s", buf);
+        if (print) printf("Received: %s", buf);
         ret = 0;
     }
 
+    /* TLS 1.3 tickets arrive after the handshake, so the session is taken
+     * once the echo has been read. */
+    if (ret == 0) {
+        SSL_SESSION_free(*session);
+        *session = SSL_get1_session(ssl);
+        /* A clean shutdown keeps the session resumable on the server. */
+        SSL_shutdown(ssl);
+    }
+
+cleanup:
+    BIO_free_all(bio);
+    return ret;
+}
+
+#ifndef _WIN32
+/* Load generator backend: one SSL_CTX per generator thread and a
+ * non-blocking SSL per connection. */
+static void *loadgen_ctx_new(void) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    SSL_CTX *ctx = SSL_CTX_new(SSLv23_client_method());
+#else
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+#endif
+    if (!ctx) return NULL;
+    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return ctx;
+}
+
+static void loadgen_ctx_free(void *ctx) {
+    SSL_CTX_free(ctx);
+}
+
+static void *loadgen_conn_new(void *ctx, int fd, const char *host, void *session) {
+    SSL *ssl = SSL_new(ctx);
+    if (!ssl) return NULL;
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, host);
+    if (session) SSL_set_session(ssl, session);
+    SSL_set_connect_state(ssl);
+    return ssl;
+}
+
+static void loadgen_conn_free(void *conn) {
+    SSL_shutdown(conn);
+    SSL_free(conn);
+}
+
+static int loadgen_result(SSL *ssl, int ret) {
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return TLS_LOADGEN_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return TLS_LOADGEN_WANT_WRITE;
+    case SSL_ERROR_ZERO_RETURN:
+        return TLS_LOADGEN_CLOSED;
+    default:
+        ERR_clear_error();
+        return TLS_LOADGEN_ERROR;
+    }
+}
+
+static int loadgen_handshake(void *conn) {
+    int ret = SSL_do_handshake(conn);
+    return ret == 1 ? 0 : loadgen_result(conn, ret);
+}
+
+static int loadgen_read(void *conn, unsigned char *buf, size_t len) {
+    int ret = SSL_read(conn, buf, (int)len);
+    return ret > 0 ? ret : loadgen_result(conn, ret);
+}
+
+static int loadgen_write(void *conn, const unsigned char *buf, size_t len) {
+    int ret = SSL_write(conn, buf, (int)len);
+    return ret > 0 ? ret : loadgen_result(conn, ret);
+}
+
+static int loadgen_resumed(void *conn) {
+    return SSL_session_reused(conn) ? 1 : 0;
+}
+
+static void *loadgen_session_get(void *conn) {
+    return SSL_get1_session(conn);
+}
+
+static void loadgen_session_free(void *session) {
+    SSL_SESSION_free(session);
+}
+
+static const struct tls_loadgen_backend loadgen_backend = {
+    OPENSSL_VERSION_TEXT,
+    loadgen_ctx_new,
+    loadgen_ctx_free,
+    loadgen_conn_new,
+    loadgen_conn_free,
+    loadgen_handshake,
+    loadgen_read,
+    loadgen_write,
+    loadgen_resumed,
+    loadgen_session_get,
+    loadgen_session_free,
+};
+#endif
+
+int main(int argc, char *argv[]) {
+#ifndef _WIN32
+    if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+        SSL_library_init();
+        SSL_load_error_strings();
+#endif
+        return tls_loadgen_main(&loadgen_backend, argc - 1, argv + 1);
+    }
+#endif
+
+    /* Parsed by hand rather than with getopt(), which MSVC lacks. */
+    int count = 1;
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        count = atoi(argv[2]);
+        arg = 3;
+    }
+    if (argc - arg != 3 || count < 1) {
+        fprintf(stderr, "Usage: %s [-n connections] <hostname> <port> <message>\n", argv[0]);
+        fprintf(stderr, "       %s -l [-c connections] [-t threads] [-d seconds] [-s size] <hostname> <port>\n", argv[0]);
+        return 1;
+    }
+    const char *host = argv[arg];
+
+    int ret = 1;
+    SSL_CTX *ctx = NULL;
+    SSL_SESSION *session = NULL;
+    int resumed = 0;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    SSL_library_init();
+    SSL_load_error_strings();
+#else
+    OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, NULL);
+#endif
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    ctx = SSL_CTX_new(SSLv23_client_method());
+#else
+    ctx = SSL_CTX_new(TLS_client_method());
+#endif
+    if (!ctx) {
+        fprintf(stderr, "SSL_CTX_new failed\n");
+        goto cleanup;
+    }
+
+    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+
+    char host_port[256];
+    snprintf(host_port, sizeof(host_port), "%s:%s", host, argv[arg + 1]);
+
+    for (int i = 0; i < count; i++) {
+        int reused = 0;
+        if (echo_once(ctx, host, host_port, argv[arg + 2], &session, &reused, i == 0) != 0) {
+            goto cleanup;
+        }
+        resumed += reused;
+    }
+    if (count > 1) {
+        printf("Resumed %d of %d reconnects (%.1f%%)\n", resumed, count - 1, 100.0 * resumed / (count - 1));
+    }
+    ret = 0;
+
 cleanup:
     if (ret != 0) {
         ERR_print_errors_fp(stderr);
     }
-    BIO_free_all(bio);
+    SSL_SESSION_free(session);
     SSL_CTX_free(ctx);
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
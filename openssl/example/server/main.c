@@ -1,3 +1,7 @@
+#define _GNU_SOURCE
+/* RSA_METHOD and EC_KEY_METHOD are deprecated in 3.0, but short of a full
+ * provider they are the only way to hook a key's private operation. */
+#define OPENSSL_SUPPRESS_DEPRECATED
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,16 +13,105 @@
 #include <openssl/rsa.h>
 #include <openssl/pem.h>
 #include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/ec.h>
+#include <openssl/async.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+
+/* One full TLS record, so a read never leaves plaintext buffered inside
+ * OpenSSL where epoll cannot see it. */
+#define BUFFER_SIZE 16384
+#define MAX_EVENTS 256
+#define MAX_THREADS 256
+/* Records echoed per wakeup before yielding to other connections. */
+#define MAX_RECORDS_PER_EVENT 16
+#define SESSION_ID_CONTEXT "tls_echo_server"
+#define MAX_SESSION_FILE_SIZE 65536
+
+/* SSL_sendfile and SSL_OP_ENABLE_KTLS need OpenSSL 3.0 configured with
+ * enable-ktls. */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define HAVE_KTLS 1
+#endif
+
+/* Returned by want_events while an offloaded key operation runs; never
+ * passed to epoll. */
+#define WAIT_ASYNC 0x80000000u
+
+/* Session resumption settings, shared by all workers. */
+struct session_options {
+    long cache_size;
+    const char *cache_dir;
+    int tickets;
+    long ticket_period;
+    unsigned char ticket_secret[32];
+};
+
+static struct session_options sessions;
+
+/* The file every connection is sent after its handshake with -f. */
+struct served_file {
+    int fd;
+    off_t size;
+};
+
+static struct served_file served = { -1, 0 };
+
+/* Totals over all workers, printed when the server is interrupted. */
+struct server_stats {
+    unsigned long conns;
+    unsigned long ktls_send;
+    unsigned long ktls_recv;
+    unsigned long long sendfile_bytes;
+    unsigned long long copied_bytes;
+};
 
-#define BUFFER_SIZE 2048
+static struct server_stats stats;
 
-static EVP_PKEY* generate_key() {
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (n), __ATOMIC_RELAXED)
+
+enum key_type {
+    KEY_RSA2048,
+    KEY_RSA3072,
+    KEY_P256,
+    KEY_ED25519
+};
+
+static const struct {
+    const char *name;
+    enum key_type type;
+} key_types[] = {
+    { "rsa2048", KEY_RSA2048 },
+    { "rsa3072", KEY_RSA3072 },
+    { "p256", KEY_P256 },
+    { "ed25519", KEY_ED25519 },
+};
+
+#define NUM_KEY_TYPES (int)(sizeof(key_types) / sizeof(key_types[0]))
+
+static EVP_PKEY* generate_key(enum key_type type) {
     EVP_PKEY *pkey = NULL;
     
-#if OPENSSL_VERSION_NUMBER >= 0x30000000L
-    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    int id = type == KEY_P256 ? EVP_PKEY_EC : type == KEY_ED25519 ? EVP_PKEY_ED25519 : EVP_PKEY_RSA;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(id, NULL);
     if (ctx == NULL) return NULL;
     
     if (EVP_PKEY_keygen_init(ctx) <= 0) {
@@ -26,7 +119,13 @@ static EVP_PKEY* generate_key() {
         return NULL;
     }
     
-    if (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0) {
+    if ((type == KEY_RSA2048 || type == KEY_RSA3072) &&
+        EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, type == KEY_RSA3072 ? 3072 : 2048) <= 0) {
+        EVP_PKEY_CTX_free(ctx);
+        return NULL;
+    }
+    
+    if (type == KEY_P256 && EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) <= 0) {
         EVP_PKEY_CTX_free(ctx);
         return NULL;
     }
@@ -38,11 +137,17 @@ static EVP_PKEY* generate_key() {
     
     EVP_PKEY_CTX_free(ctx);
     
-#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+#else
+    int bits = type == KEY_RSA3072 ? 3072 : 2048;
+    if (type != KEY_RSA2048 && type != KEY_RSA3072) {
+        fprintf(stderr, "ECDSA and Ed25519 keys need OpenSSL 1.1.1 or later\n");
+        return NULL;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
     BIGNUM *bn = BN_new();
     RSA *rsa = RSA_new();
     
-    if (!BN_set_word(bn, RSA_F4) || !RSA_generate_key_ex(rsa, 2048, bn, NULL)) {
+    if (!BN_set_word(bn, RSA_F4) || !RSA_generate_key_ex(rsa, bits, bn, NULL)) {
         BN_free(bn);
         RSA_free(rsa);
         return NULL;
@@ -58,7 +163,7 @@ static EVP_PKEY* generate_key() {
     BN_free(bn);
     
 #else
-    RSA *rsa = RSA_generate_key(2048, RSA_F4, NULL, NULL);
+    RSA *rsa = RSA_generate_key(bits, RSA_F4, NULL, NULL);
     if (!rsa) return NULL;
     
     pkey = EVP_PKEY_new();
@@ -67,17 +172,64 @@ static EVP_PKEY* generate_key() {
         RSA_free(rsa);
         pkey = NULL;
     }
+#endif
 #endif
     
     return pkey;
 }
 
-static SSL_CTX* create_context_with_cert() {
-    SSL_CTX *ctx;
-    EVP_PKEY *pkey = NULL;
+static X509* generate_cert(EVP_PKEY *pkey, enum key_type type) {
     X509 *x509 = NULL;
     X509_NAME *name = NULL;
     
+    x509 = X509_new();
+    if (!x509) return NULL;
+    
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_get_notBefore(x509), 0);
+    X509_gmtime_adj(X509_get_notAfter(x509), 31536000L); 
+    X509_set_pubkey(x509, pkey);
+    
+    name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char*)"TLS Echo Server", -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    
+    /* Ed25519 signs the message itself and takes no digest. */
+    if (X509_sign(x509, pkey, type == KEY_ED25519 ? NULL : EVP_sha256()) <= 0) {
+        X509_free(x509);
+        return NULL;
+    }
+    return x509;
+}
+
+/* Writes the generated key and certificate so later starts can load them.
+ * The key file is created readable by the owner only. */
+static int save_cert(const char *cert_file, const char *key_file, X509 *x509, EVP_PKEY *pkey) {
+    int fd = open(key_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!fp) {
+        if (fd >= 0) close(fd);
+        perror(key_file);
+        return -1;
+    }
+    int ok = PEM_write_PrivateKey(fp, pkey, NULL, NULL, 0, NULL, NULL);
+    if (fclose(fp) != 0) ok = 0;
+    
+    fp = ok ? fopen(cert_file, "w") : NULL;
+    if (fp) {
+        ok = PEM_write_X509(fp, x509);
+        if (fclose(fp) != 0) ok = 0;
+    } else if (ok) {
+        perror(cert_file);
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+static SSL_CTX* create_context() {
+    SSL_CTX *ctx;
+    
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
     ctx = SSL_CTX_new(SSLv23_server_method());
 #else
@@ -88,32 +240,30 @@ static SSL_CTX* create_context_with_cert() {
         return NULL;
     }
     SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    return ctx;
+}
+
+static SSL_CTX* create_context_with_cert(enum key_type type) {
+    SSL_CTX *ctx;
+    EVP_PKEY *pkey = NULL;
+    X509 *x509 = NULL;
+    
+    ctx = create_context();
+    if (!ctx) return NULL;
     
-    pkey = generate_key();
+    pkey = generate_key(type);
     if (!pkey) {
         SSL_CTX_free(ctx);
         return NULL;
     }
     
-    x509 = X509_new();
+    x509 = generate_cert(pkey, type);
     if (!x509) {
         EVP_PKEY_free(pkey);
         SSL_CTX_free(ctx);
         return NULL;
     }
     
-    X509_set_version(x509, 2);
-    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
-    X509_gmtime_adj(X509_get_notBefore(x509), 0);
-    X509_gmtime_adj(X509_get_notAfter(x509), 31536000L); 
-    X509_set_pubkey(x509, pkey);
-    
-    name = X509_get_subject_name(x509);
-    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char*)"TLS Echo Server", -1, -1, 0);
-    X509_set_issuer_name(x509, name);
-    
-    X509_sign(x509, pkey, EVP_sha256());
-    
     SSL_CTX_use_certificate(ctx, x509);
     SSL_CTX_use_PrivateKey(ctx, pkey);
     
@@ -123,17 +273,560 @@ static SSL_CTX* create_context_with_cert() {
     return ctx;
 }
 
+/* Loads the certificate and key from disk. If neither file exists yet, a
+ * certificate of the given type is generated and written there first. */
+static SSL_CTX* create_context_from_files(const char *cert_file, const char *key_file, enum key_type type) {
+    SSL_CTX *ctx;
+    
+    if (access(cert_file, F_OK) != 0 && access(key_file, F_OK) != 0) {
+        EVP_PKEY *pkey = generate_key(type);
+        X509 *x509 = pkey ? generate_cert(pkey, type) : NULL;
+        int ret = x509 ? save_cert(cert_file, key_file, x509, pkey) : -1;
+        EVP_PKEY_free(pkey);
+        X509_free(x509);
+        if (ret != 0) return NULL;
+        printf("Generated %s and %s\n", cert_file, key_file);
+    }
+    
+    ctx = create_context();
+    if (!ctx) return NULL;
+    
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) <= 0 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) <= 0 ||
+        !SSL_CTX_check_private_key(ctx)) {
+        fprintf(stderr, "Cannot load %s and %s\n", cert_file, key_file);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static int parse_key_type(const char *name, enum key_type *type) {
+    for (int i = 0; i < NUM_KEY_TYPES; i++) {
+        if (strcmp(name, key_types[i].name) == 0) {
+            *type = key_types[i].type;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown key type '%s'\n", name);
+    return -1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int handshake_pending(SSL *ssl, int ret) {
+    int err = SSL_get_error(ssl, ret);
+    return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+}
+
+/* Runs one full handshake between a client and a server connected by a
+ * memory BIO pair, so no sockets or scheduling are involved. */
+static int bench_handshake(SSL_CTX *server_ctx, SSL_CTX *client_ctx) {
+    SSL *server = SSL_new(server_ctx);
+    SSL *client = SSL_new(client_ctx);
+    BIO *server_bio = NULL, *client_bio = NULL;
+    int ret = -1;
+    
+    if (server && client && BIO_new_bio_pair(&server_bio, 0, &client_bio, 0)) {
+        SSL_set_bio(server, server_bio, server_bio);
+        SSL_set_bio(client, client_bio, client_bio);
+        SSL_set_accept_state(server);
+        SSL_set_connect_state(client);
+        
+        for (int round = 0; round < 16; round++) {
+            int rc = SSL_do_handshake(client);
+            int rs = SSL_do_handshake(server);
+            if (rc == 1 && rs == 1) {
+                ret = 0;
+                break;
+            }
+            if ((rc != 1 && !handshake_pending(client, rc)) || (rs != 1 && !handshake_pending(server, rs))) {
+                break;
+            }
+        }
+    }
+    SSL_free(server);
+    SSL_free(client);
+    return ret;
+}
+
+/* Measures key generation time and full handshakes per second (client and
+ * server work together on one thread) for every key type. */
+static int run_benchmark(double seconds) {
+    SSL_CTX *client_ctx = NULL;
+    int ret = 0;
+    
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    client_ctx = SSL_CTX_new(SSLv23_client_method());
+#else
+    client_ctx = SSL_CTX_new(TLS_client_method());
+#endif
+    if (!client_ctx) return -1;
+    SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_session_cache_mode(client_ctx, SSL_SESS_CACHE_OFF);
+    
+    printf("%-8s %10s %14s\n", "key", "keygen ms", "handshakes/s");
+    for (int i = 0; i < NUM_KEY_TYPES; i++) {
+        double start = now_seconds();
+        SSL_CTX *server_ctx = create_context_with_cert(key_types[i].type);
+        double keygen = now_seconds() - start;
+        if (!server_ctx) {
+            printf("%-8s %10s %14s\n", key_types[i].name, "-", "unsupported");
+            ERR_clear_error();
+            continue;
+        }
+        SSL_CTX_set_session_cache_mode(server_ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(server_ctx, SSL_OP_NO_TICKET);
+        
+        long count = 0;
+        double elapsed;
+        start = now_seconds();
+        do {
+            if (bench_handshake(server_ctx, client_ctx) != 0) {
+                ERR_print_errors_fp(stderr);
+                ret = -1;
+                break;
+            }
+            count++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < seconds);
+        
+        if (ret == 0) {
+            printf("%-8s %10.1f %14.1f\n", key_types[i].name, keygen * 1000, count / elapsed);
+        }
+        SSL_CTX_free(server_ctx);
+        if (ret != 0) break;
+    }
+    
+    SSL_CTX_free(client_ctx);
+    return ret;
+}
+
+/* Shared session cache: one file per session ID in sessions.cache_dir, so
+ * several server processes can resume each other's sessions. It backs the
+ * in-memory cache, which OpenSSL consults first. */
+static void session_path(char *path, size_t size, const unsigned char *id, unsigned int id_len) {
+    size_t n = (size_t)snprintf(path, size, "%s/", sessions.cache_dir);
+    for (unsigned int i = 0; i < id_len && n + 3 <= size; i++) {
+        n += (size_t)snprintf(path + n, size - n, "%02x", id[i]);
+    }
+}
+
+static int new_session_cb(SSL *ssl, SSL_SESSION *sess) {
+    char path[4096], tmp[4096];
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    int len = i2d_SSL_SESSION(sess, NULL);
+    (void)ssl;
+
+    unsigned char *der = len > 0 ? malloc(len) : NULL;
+    if (!der) return 0;
+    unsigned char *p = der;
+    i2d_SSL_SESSION(sess, &p);
+
+    session_path(path, sizeof(path), id, id_len);
+    snprintf(tmp, sizeof(tmp), "%s/.new-XXXXXX", sessions.cache_dir);
+    int fd = mkstemp(tmp);
+    if (fd >= 0) {
+        int ok = write(fd, der, len) == len;
+        close(fd);
+        if (!ok || rename(tmp, path) != 0) unlink(tmp);
+    }
+    free(der);
+    /* The session was only serialized, not retained. */
+    return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static SSL_SESSION *get_session_cb(SSL *ssl, const unsigned char *id, int id_len, int *copy) {
+#else
+static SSL_SESSION *get_session_cb(SSL *ssl, unsigned char *id, int id_len, int *copy) {
+#endif
+    char path[4096];
+    unsigned char der[MAX_SESSION_FILE_SIZE];
+    SSL_SESSION *sess = NULL;
+    (void)ssl;
+
+    *copy = 0;
+    session_path(path, sizeof(path), id, (unsigned int)id_len);
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        size_t len = fread(der, 1, sizeof(der), fp);
+        const unsigned char *p = der;
+        sess = d2i_SSL_SESSION(NULL, &p, (long)len);
+        fclose(fp);
+    }
+    return sess;
+}
+
+static void remove_session_cb(SSL_CTX *ctx, SSL_SESSION *sess) {
+    char path[4096];
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    (void)ctx;
+
+    session_path(path, sizeof(path), id, id_len);
+    unlink(path);
+}
+
+/* Ticket keys are derived from a secret and the current rotation period,
+ * so processes sharing the secret rotate in lockstep without talking to
+ * each other. Tickets from the previous period are still accepted and
+ * renewed. */
+struct ticket_key {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+};
+
+static void derive_ticket_key(uint64_t period, struct ticket_key *key) {
+    unsigned char label[9];
+    unsigned char out[EVP_MAX_MD_SIZE];
+    unsigned int len;
+
+    for (int i = 0; i < 8; i++) {
+        label[i] = (unsigned char)(period >> (56 - 8 * i));
+    }
+    label[8] = 'n';
+    HMAC(EVP_sha512(), sessions.ticket_secret, sizeof(sessions.ticket_secret), label, sizeof(label), out, &len);
+    memcpy(key->name, out, sizeof(key->name));
+    label[8] = 'k';
+    HMAC(EVP_sha512(), sessions.ticket_secret, sizeof(sessions.ticket_secret), label, sizeof(label), out, &len);
+    memcpy(key->aes_key, out, sizeof(key->aes_key));
+    memcpy(key->hmac_key, out + sizeof(key->aes_key), sizeof(key->hmac_key));
+    OPENSSL_cleanse(out, sizeof(out));
+}
+
+/* Returns 1 for the current key, 2 for the previous one (renew the ticket)
+ * and 0 for an unknown key name. */
+static int find_ticket_key(unsigned char *key_name, int enc, struct ticket_key *key) {
+    uint64_t period = (uint64_t)time(NULL) / (uint64_t)sessions.ticket_period;
+
+    derive_ticket_key(period, key);
+    if (enc) {
+        memcpy(key_name, key->name, sizeof(key->name));
+        return 1;
+    }
+    if (CRYPTO_memcmp(key_name, key->name, sizeof(key->name)) == 0) return 1;
+    derive_ticket_key(period - 1, key);
+    if (CRYPTO_memcmp(key_name, key->name, sizeof(key->name)) == 0) return 2;
+    return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *ctx, EVP_MAC_CTX *hctx, int enc) {
+#else
+static int ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc) {
+#endif
+    struct ticket_key key;
+    int ret = find_ticket_key(key_name, enc, &key);
+    (void)ssl;
+
+    if (ret != 0) {
+        if (enc && RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0) {
+            ret = -1;
+        } else if (!EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv, enc)) {
+            ret = -1;
+        } else {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            OSSL_PARAM params[2];
+            params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+            params[1] = OSSL_PARAM_construct_end();
+            if (!EVP_MAC_init(hctx, key.hmac_key, sizeof(key.hmac_key), params)) ret = -1;
+#else
+            if (!HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL)) ret = -1;
+#endif
+        }
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+    return ret;
+}
+
+static int configure_sessions(SSL_CTX *ctx) {
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    if (sessions.cache_size == 0 && !sessions.cache_dir) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    } else if (sessions.cache_size == 0) {
+        /* A cache size of 0 means unlimited to OpenSSL; keep sessions only
+         * in the on-disk cache instead. */
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, sessions.cache_size);
+    }
+    if (sessions.cache_dir) {
+        SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+        SSL_CTX_sess_set_get_cb(ctx, get_session_cb);
+        SSL_CTX_sess_set_remove_cb(ctx, remove_session_cb);
+    }
+
+    if (!sessions.tickets) {
+        /* Without tickets TLS 1.3 falls back to stateful PSKs that are
+         * looked up in the session caches above. */
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        return 0;
+    }
+    /* A session must not outlive the ticket keys that can open it. */
+    SSL_CTX_set_timeout(ctx, sessions.ticket_period);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb) != 1) return -1;
+#else
+    if (SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_cb) != 1) return -1;
+#endif
+    return 0;
+}
+
+static int load_ticket_secret(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    size_t len = fread(sessions.ticket_secret, 1, sizeof(sessions.ticket_secret), fp);
+    fclose(fp);
+    if (len != sizeof(sessions.ticket_secret)) {
+        fprintf(stderr, "Ticket key file must hold at least %d bytes\n", (int)sizeof(sessions.ticket_secret));
+        return -1;
+    }
+    return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/*
+ * Private key offload. The server key is wrapped in an RSA_METHOD or
+ * EC_KEY_METHOD whose private operation is queued to a pool of crypto
+ * threads. Inside an SSL_MODE_ASYNC job the handshake pauses until the
+ * result is ready, so the worker keeps serving other connections; each
+ * connection's wait context gets an eventfd that the pool signals and the
+ * worker watches in epoll. Outside a job the operation runs inline.
+ */
+struct key_op {
+    struct key_op *next;
+    int (*run)(struct key_op *op);
+    int efd;
+    int done;
+    int result;
+    /* RSA private encryption, which both PKCS#1 and PSS signing end in */
+    int flen;
+    const unsigned char *from;
+    unsigned char *to;
+    RSA *rsa;
+    int padding;
+    /* ECDSA signing */
+    int type;
+    const unsigned char *dgst;
+    int dlen;
+    unsigned char *sig;
+    unsigned int *siglen;
+    const BIGNUM *kinv;
+    const BIGNUM *r;
+    EC_KEY *eckey;
+};
+
+struct key_offload {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct key_op *head;
+    struct key_op *tail;
+    RSA_METHOD *rsa_method;
+    EC_KEY_METHOD *ec_method;
+    int (*rsa_priv_enc)(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+    int (*ec_sign)(int type, const unsigned char *dgst, int dlen, unsigned char *sig,
+                   unsigned int *siglen, const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey);
+};
+
+static struct key_offload offload = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static void *offload_thread(void *arg) {
+    uint64_t one = 1;
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&offload.lock);
+        while (!offload.head) {
+            pthread_cond_wait(&offload.cond, &offload.lock);
+        }
+        struct key_op *op = offload.head;
+        offload.head = op->next;
+        if (!offload.head) offload.tail = NULL;
+        pthread_mutex_unlock(&offload.lock);
+
+        op->result = op->run(op);
+        /* Signal before marking done: once done is seen, the job may
+         * return and its connection close the eventfd. */
+        if (write(op->efd, &one, sizeof(one)) < 0) perror("eventfd");
+        __atomic_store_n(&op->done, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void free_wait_fd(ASYNC_WAIT_CTX *ctx, const void *key, OSSL_ASYNC_FD fd, void *data) {
+    (void)ctx;
+    (void)key;
+    (void)data;
+    close(fd);
+}
+
+static int offload_run(struct key_op *op) {
+    ASYNC_JOB *job = ASYNC_get_current_job();
+    ASYNC_WAIT_CTX *wait_ctx;
+    OSSL_ASYNC_FD efd;
+    void *data;
+    uint64_t count;
+
+    if (!job || !(wait_ctx = ASYNC_get_wait_ctx(job))) {
+        return op->run(op);
+    }
+    if (!ASYNC_WAIT_CTX_get_fd(wait_ctx, &offload, &efd, &data)) {
+        efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (efd < 0 || !ASYNC_WAIT_CTX_set_wait_fd(wait_ctx, &offload, efd, NULL, free_wait_fd)) {
+            if (efd >= 0) close(efd);
+            return op->run(op);
+        }
+    }
+    op->efd = efd;
+    op->done = 0;
+    op->next = NULL;
+
+    pthread_mutex_lock(&offload.lock);
+    if (offload.tail) {
+        offload.tail->next = op;
+    } else {
+        offload.head = op;
+    }
+    offload.tail = op;
+    pthread_cond_signal(&offload.cond);
+    pthread_mutex_unlock(&offload.lock);
+
+    /* The connection may be stepped for socket events before the result
+     * is ready; pause again until it is. */
+    while (!__atomic_load_n(&op->done, __ATOMIC_ACQUIRE)) {
+        ASYNC_pause_job();
+    }
+    if (read(efd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("eventfd");
+    return op->result;
+}
+
+static int run_rsa_priv_enc(struct key_op *op) {
+    return offload.rsa_priv_enc(op->flen, op->from, op->to, op->rsa, op->padding);
+}
+
+static int offload_rsa_priv_enc(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding) {
+    struct key_op op;
+
+    memset(&op, 0, sizeof(op));
+    op.run = run_rsa_priv_enc;
+    op.flen = flen;
+    op.from = from;
+    op.to = to;
+    op.rsa = rsa;
+    op.padding = padding;
+    return offload_run(&op);
+}
+
+static int run_ec_sign(struct key_op *op) {
+    return offload.ec_sign(op->type, op->dgst, op->dlen, op->sig, op->siglen, op->kinv, op->r, op->eckey);
+}
+
+static int offload_ec_sign(int type, const unsigned char *dgst, int dlen, unsigned char *sig,
+                           unsigned int *siglen, const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey) {
+    struct key_op op;
+
+    memset(&op, 0, sizeof(op));
+    op.run = run_ec_sign;
+    op.type = type;
+    op.dgst = dgst;
+    op.dlen = dlen;
+    op.sig = sig;
+    op.siglen = siglen;
+    op.kinv = kinv;
+    op.r = r;
+    op.eckey = eckey;
+    return offload_run(&op);
+}
+
+/* Replaces the context's private key with a wrapped copy that signs on
+ * the crypto threads, and starts them. */
+static int offload_private_key(SSL_CTX *ctx, int threads) {
+    EVP_PKEY *pkey = SSL_CTX_get0_privatekey(ctx);
+    EVP_PKEY *wrapped = EVP_PKEY_new();
+    int ok = 0;
+
+    if (!pkey || !wrapped) goto done;
+    if (EVP_PKEY_base_id(pkey) == EVP_PKEY_RSA) {
+        RSA *rsa = EVP_PKEY_get1_RSA(pkey);
+        offload.rsa_method = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+        offload.rsa_priv_enc = RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL());
+        if (!rsa || !offload.rsa_method ||
+            !RSA_meth_set_priv_enc(offload.rsa_method, offload_rsa_priv_enc) ||
+            !RSA_set_method(rsa, offload.rsa_method) ||
+            !EVP_PKEY_assign_RSA(wrapped, rsa)) {
+            RSA_free(rsa);
+            goto done;
+        }
+    } else if (EVP_PKEY_base_id(pkey) == EVP_PKEY_EC) {
+        EC_KEY *ec = EVP_PKEY_get1_EC_KEY(pkey);
+        int (*sign_setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+        ECDSA_SIG *(*sign_sig)(const unsigned char *, int, const BIGNUM *, const BIGNUM *, EC_KEY *);
+        offload.ec_method = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+        EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &offload.ec_sign, &sign_setup, &sign_sig);
+        if (!ec || !offload.ec_method) {
+            EC_KEY_free(ec);
+            goto done;
+        }
+        EC_KEY_METHOD_set_sign(offload.ec_method, offload_ec_sign, sign_setup, sign_sig);
+        if (!EC_KEY_set_method(ec, offload.ec_method) || !EVP_PKEY_assign_EC_KEY(wrapped, ec)) {
+            EC_KEY_free(ec);
+            goto done;
+        }
+    } else {
+        fprintf(stderr, "Key offload supports RSA and ECDSA keys only\n");
+        goto done;
+    }
+    if (SSL_CTX_use_PrivateKey(ctx, wrapped) <= 0) goto done;
+
+    for (int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, offload_thread, NULL) != 0) {
+            fprintf(stderr, "pthread_create failed for the crypto threads\n");
+            goto done;
+        }
+        pthread_detach(thread);
+    }
+    SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+    ok = 1;
+
+done:
+    EVP_PKEY_free(wrapped);
+    return ok ? 0 : -1;
+}
+#else
+static int offload_private_key(SSL_CTX *ctx, int threads) {
+    (void)ctx;
+    (void)threads;
+    fprintf(stderr, "Key offload needs OpenSSL 1.1.0 or later\n");
+    return -1;
+}
+#endif
+
 static int create_socket(int port) {
     int sockfd;
     struct sockaddr_in addr;
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (sockfd < 0) {
         perror("socket");
         return -1;
     }
     
     int enable = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0) {
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0 ||
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) < 0) {
         perror("setsockopt");
         close(sockfd);
         return -1;
@@ -150,7 +843,7 @@ static int create_socket(int port) {
         return -1;
     }
     
-    if (listen(sockfd, 5) < 0) {
+    if (listen(sockfd, SOMAXCONN) < 0) {
         perror("listen");
         close(sockfd);
         return -1;
@@ -159,21 +852,493 @@ static int create_socket(int port) {
     return sockfd;
 }
 
+/* Every worker owns a SO_REUSEPORT listener and an epoll set, so the kernel
+ * spreads new connections across workers and a connection never leaves the
+ * thread that accepted it. */
+struct worker {
+    pthread_t thread;
+    SSL_CTX *ctx;
+    int listen_fd;
+    int epoll_fd;
+    int verbose;
+};
+
+struct conn {
+    int fd;
+    SSL *ssl;
+    int handshake_done;
+    uint32_t events;
+    int pending;
+    int written;
+    int ktls_send;
+    int async_fd;
+    off_t file_offset;
+    char buf[BUFFER_SIZE];
+};
+
+static void close_conn(struct worker *w, struct conn *c) {
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->async_fd >= 0) {
+        /* The wait context closes it in SSL_free. */
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->async_fd, NULL);
+    }
+    SSL_free(c->ssl);
+    close(c->fd);
+    free(c);
+}
+
+/* Maps the result of a non-blocking SSL call to the epoll events it waits
+ * for; returns 0 when the connection is finished or failed. */
+static uint32_t want_events(SSL *ssl, int ret) {
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return EPOLLIN;
+    case SSL_ERROR_WANT_WRITE:
+        return EPOLLOUT;
+#ifdef SSL_ERROR_WANT_ASYNC
+    case SSL_ERROR_WANT_ASYNC:
+        return WAIT_ASYNC;
+#endif
+    case SSL_ERROR_ZERO_RETURN:
+        /* Answer the close_notify; a connection freed without one has its
+         * session dropped from the cache. */
+        SSL_shutdown(ssl);
+        return 0;
+    default:
+        ERR_clear_error();
+        return 0;
+    }
+}
+
+/* Records whether OpenSSL handed record encryption to the kernel. With
+ * kTLS on, SSL_read and SSL_write already go through the kernel. */
+static void note_handshake(struct worker *w, struct conn *c) {
+    int ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(c->ssl));
+
+#ifdef SSL_MODE_ASYNC
+    /* Only handshakes sign; echoing outside async jobs saves a context
+     * switch per record. */
+    SSL_clear_mode(c->ssl, SSL_MODE_ASYNC);
+#endif
+    c->ktls_send = BIO_get_ktls_send(SSL_get_wbio(c->ssl));
+    STAT_ADD(conns, 1);
+    if (c->ktls_send) STAT_ADD(ktls_send, 1);
+    if (ktls_recv) STAT_ADD(ktls_recv, 1);
+    if (w->verbose) {
+        printf("Handshake done with %s, kTLS send %s, receive %s\n", SSL_get_cipher(c->ssl),
+               c->ktls_send ? "on" : "off", ktls_recv ? "on" : "off");
+    }
+}
+
+/* Sends the -f file and closes. With kTLS send on, SSL_sendfile passes the
+ * file to the kernel, which encrypts it without a copy through userspace;
+ * otherwise the file is read into the buffer and written with SSL_write. */
+static uint32_t send_file(struct conn *c) {
+    int ret;
+
+    for (int records = 0; records < MAX_RECORDS_PER_EVENT; records++) {
+        while (c->written < c->pending) {
+            ret = SSL_write(c->ssl, c->buf + c->written, c->pending - c->written);
+            if (ret <= 0) {
+                return want_events(c->ssl, ret);
+            }
+            c->written += ret;
+        }
+
+        if (c->file_offset >= served.size) {
+            ret = SSL_shutdown(c->ssl);
+            if (ret < 0 && SSL_get_error(c->ssl, ret) == SSL_ERROR_WANT_WRITE) {
+                return EPOLLOUT;
+            }
+            return 0;
+        }
+
+#ifdef HAVE_KTLS
+        if (c->ktls_send) {
+            ossl_ssize_t sent = SSL_sendfile(c->ssl, served.fd, c->file_offset,
+                                             (size_t)(served.size - c->file_offset), 0);
+            if (sent <= 0) {
+                return want_events(c->ssl, (int)sent);
+            }
+            c->file_offset += sent;
+            STAT_ADD(sendfile_bytes, (unsigned long long)sent);
+            continue;
+        }
+#endif
+        ssize_t len = pread(served.fd, c->buf, sizeof(c->buf), c->file_offset);
+        if (len <= 0) {
+            if (len < 0) perror("pread");
+            return 0;
+        }
+        c->file_offset += len;
+        c->pending = (int)len;
+        c->written = 0;
+        STAT_ADD(copied_bytes, (unsigned long long)len);
+    }
+    return EPOLLOUT;
+}
+
+/* Advances the connection as far as it goes without blocking: finishes the
+ * handshake, then echoes records back until the socket runs dry. Returns
+ * the events to wait for next, or 0 to close. */
+static uint32_t conn_step(struct worker *w, struct conn *c) {
+    int ret;
+
+    if (!c->handshake_done) {
+        ret = SSL_accept(c->ssl);
+        if (ret <= 0) {
+            return want_events(c->ssl, ret);
+        }
+        c->handshake_done = 1;
+        note_handshake(w, c);
+    }
+    if (served.fd >= 0) {
+        return send_file(c);
+    }
+
+    for (int records = 0; records < MAX_RECORDS_PER_EVENT; records++) {
+        while (c->written < c->pending) {
+            ret = SSL_write(c->ssl, c->buf + c->written, c->pending - c->written);
+            if (ret <= 0) {
+                return want_events(c->ssl, ret);
+            }
+            c->written += ret;
+        }
+
+        ret = SSL_read(c->ssl, c->buf, sizeof(c->buf));
+        if (ret <= 0) {
+            return want_events(c->ssl, ret);
+        }
+        if (w->verbose) {
+            printf("Received: %.*s", ret, c->buf);
+        }
+        c->pending = ret;
+        c->written = 0;
+    }
+    return EPOLLIN | EPOLLOUT;
+}
+
+static void accept_conns(struct worker *w) {
+    while (1) {
+        int client = accept4(w->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (client < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept");
+            }
+            if (errno != EINTR) {
+                return;
+            }
+            continue;
+        }
+        /* The session tickets and the first echo are separate small
+         * writes; without this the echo waits for a delayed ACK. */
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct conn *c = calloc(1, sizeof(*c));
+        SSL *ssl = c ? SSL_new(w->ctx) : NULL;
+        if (!ssl) {
+            free(c);
+            close(client);
+            ERR_print_errors_fp(stderr);
+            continue;
+        }
+        c->fd = client;
+        c->async_fd = -1;
+        c->ssl = ssl;
+        c->events = EPOLLIN;
+        SSL_set_fd(ssl, client);
+        SSL_set_accept_state(ssl);
+
+        struct epoll_event ev;
+        ev.events = c->events;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, client, &ev) < 0) {
+            perror("epoll_ctl");
+            SSL_free(ssl);
+            close(client);
+            free(c);
+        }
+    }
+}
+
+/* Watches the eventfd that the crypto threads signal when a paused key
+ * operation finishes. The socket is left alone until the handshake can go
+ * on. Returns the socket events to wait for. */
+static uint32_t wait_async(struct worker *w, struct conn *c) {
+#ifdef SSL_MODE_ASYNC
+    OSSL_ASYNC_FD fd;
+    size_t numfds = 0;
+
+    if (c->async_fd < 0 && SSL_get_all_async_fds(c->ssl, NULL, &numfds) && numfds == 1 &&
+        SSL_get_all_async_fds(c->ssl, &fd, &numfds)) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+        } else {
+            c->async_fd = fd;
+        }
+    }
+    if (c->async_fd < 0) {
+        /* Without the fd, poll the operation through the socket. */
+        return EPOLLIN | EPOLLOUT;
+    }
+#else
+    (void)w;
+    (void)c;
+#endif
+    return 0;
+}
+
+static void *worker_loop(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return NULL;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct conn *c = events[i].data.ptr;
+            if (c == NULL) {
+                accept_conns(w);
+                continue;
+            }
+            if (c == (struct conn *)w) {
+                continue;
+            }
+
+            uint32_t want = conn_step(w, c);
+            if (want == 0) {
+                /* With an async fd the connection can come up twice in one
+                 * batch; mark the later entry so it is skipped. */
+                for (int j = i + 1; c->async_fd >= 0 && j < n; j++) {
+                    if (events[j].data.ptr == c) events[j].data.ptr = w;
+                }
+                close_conn(w, c);
+                continue;
+            }
+            if (want == WAIT_ASYNC) {
+                want = wait_async(w, c);
+            }
+            if (want != c->events) {
+                struct epoll_event ev;
+                ev.events = want;
+                ev.data.ptr = c;
+                c->events = want;
+                epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+            }
+        }
+    }
+}
+
+static int setup_worker(struct worker *w, SSL_CTX *ctx, int port, int verbose) {
+    struct epoll_event ev;
+
+    w->ctx = ctx;
+    w->verbose = verbose;
+    w->epoll_fd = -1;
+    w->listen_fd = create_socket(port);
+    if (w->listen_fd < 0) return -1;
+
+    w->epoll_fd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (w->epoll_fd < 0 || epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd, &ev) < 0) {
+        perror("epoll");
+        return -1;
+    }
+    return 0;
+}
+
+static int enable_ktls(SSL_CTX *ctx) {
+#ifdef HAVE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    return 0;
+#else
+    (void)ctx;
+    fprintf(stderr, "This OpenSSL has no kTLS support; build OpenSSL 3.0 or later with ENABLE_KTLS=ON\n");
+    return -1;
+#endif
+}
+
+static int open_served_file(const char *path) {
+    struct stat st;
+
+    served.fd = open(path, O_RDONLY);
+    if (served.fd < 0 || fstat(served.fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        fprintf(stderr, "%s: not a regular file\n", path);
+        return -1;
+    }
+    served.size = st.st_size;
+    return 0;
+}
+
+static void print_stats(void) {
+    printf("Connections: %lu, kTLS send: %lu, kTLS receive: %lu\n",
+           __atomic_load_n(&stats.conns, __ATOMIC_RELAXED),
+           __atomic_load_n(&stats.ktls_send, __ATOMIC_RELAXED),
+           __atomic_load_n(&stats.ktls_recv, __ATOMIC_RELAXED));
+    if (served.fd >= 0) {
+        printf("File bytes sent with SSL_sendfile: %llu, with SSL_write: %llu\n",
+               __atomic_load_n(&stats.sendfile_bytes, __ATOMIC_RELAXED),
+               __atomic_load_n(&stats.copied_bytes, __ATOMIC_RELAXED));
+    }
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t threads] [-v] [-k type] [-c cert.pem -p key.pem]\n"
+                    "       [-C size] [-S dir] [-N] [-K file] [-R seconds] [-T] [-f file] [-A threads] <port>\n", prog);
+    fprintf(stderr, "       %s -B seconds\n", prog);
+    fprintf(stderr, "  -t threads  worker threads, each with its own listener (default: CPU count)\n");
+    fprintf(stderr, "  -v          print received data\n");
+    fprintf(stderr, "  -k type     certificate key: rsa2048 (default), rsa3072, p256 or ed25519\n");
+    fprintf(stderr, "  -c -p       load the certificate and key from these files, generating\n");
+    fprintf(stderr, "              them with -k first if neither exists\n");
+    fprintf(stderr, "  -C size     in-memory session cache entries, 0 to disable (default 20480)\n");
+    fprintf(stderr, "  -S dir      share the session cache with other processes through dir\n");
+    fprintf(stderr, "  -N          disable session tickets\n");
+    fprintf(stderr, "  -K file     ticket key secret (32 bytes), shared by processes that should\n");
+    fprintf(stderr, "              accept each other's tickets (default: random per process)\n");
+    fprintf(stderr, "  -R seconds  ticket key rotation period and session lifetime (default 3600)\n");
+    fprintf(stderr, "  -T          let the kernel encrypt and decrypt records (kTLS) when it can\n");
+    fprintf(stderr, "  -f file     send this file after the handshake and close, instead of echoing\n");
+    fprintf(stderr, "  -A threads  sign handshakes on this many crypto threads (RSA and P-256 keys)\n");
+    fprintf(stderr, "  -B seconds  benchmark key generation and handshakes for every key type, then exit\n");
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int verbose = 0;
+    const char *ticket_key_file = NULL;
+    const char *cert_file = NULL;
+    const char *key_file = NULL;
+    enum key_type key_type = KEY_RSA2048;
+    const char *file = NULL;
+    double bench_seconds = 0;
+    int ktls = 0;
+    int offload_threads = 0;
+    int opt;
+
+    sessions.cache_size = SSL_SESSION_CACHE_MAX_SIZE_DEFAULT;
+    sessions.tickets = 1;
+    sessions.ticket_period = 3600;
+    while ((opt = getopt(argc, argv, "t:vk:c:p:C:S:NK:R:B:Tf:A:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'k':
+            if (parse_key_type(optarg, &key_type) != 0) return 1;
+            break;
+        case 'c':
+            cert_file = optarg;
+            break;
+        case 'p':
+            key_file = optarg;
+            break;
+        case 'B':
+            bench_seconds = atof(optarg);
+            if (bench_seconds <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'C':
+            sessions.cache_size = atol(optarg);
+            break;
+        case 'S':
+            sessions.cache_dir = optarg;
+            break;
+        case 'N':
+            sessions.tickets = 0;
+            break;
+        case 'K':
+            ticket_key_file = optarg;
+            break;
+        case 'R':
+            sessions.ticket_period = atol(optarg);
+            break;
+        case 'T':
+            ktls = 1;
+            break;
+        case 'f':
+            file = optarg;
+            break;
+        case 'A':
+            offload_threads = atoi(optarg);
+            if (offload_threads < 1 || offload_threads > MAX_THREADS) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (bench_seconds > 0 && optind == argc) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+        SSL_library_init();
+        SSL_load_error_strings();
+#endif
+        return run_benchmark(bench_seconds) == 0 ? 0 : 1;
+    }
+    if (optind != argc - 1 || (!cert_file != !key_file)) {
+        usage(argv[0]);
         return 1;
     }
     
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
     if (port <= 0 || port > 65535) {
         fprintf(stderr, "Invalid port number\n");
         return 1;
     }
+    if (threads < 1 || threads > MAX_THREADS) {
+        fprintf(stderr, "Thread count must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+    if (sessions.cache_size < 0 || sessions.ticket_period <= 0) {
+        fprintf(stderr, "Invalid session cache size or ticket rotation period\n");
+        return 1;
+    }
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    /* OpenSSL 1.0.x needs locking callbacks to share an SSL_CTX between
+     * threads. */
+    threads = 1;
+#endif
     
     int ret = 1;
-    int sockfd = -1;
+    int ready = 0;
+    int started = 0;
     SSL_CTX *ctx = NULL;
+    sigset_t stop_signals;
+    int sig;
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+    if (!workers) goto cleanup;
+
+    signal(SIGPIPE, SIG_IGN);
+    /* Workers inherit the mask, so only the main thread takes these. */
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    if (file && open_served_file(file) != 0) goto cleanup;
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
     SSL_library_init();
@@ -182,52 +1347,57 @@ int main(int argc, char **argv) {
     OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, NULL);
 #endif
 
-    ctx = create_context_with_cert();
+    if (ticket_key_file) {
+        if (load_ticket_secret(ticket_key_file) != 0) goto cleanup;
+    } else if (RAND_bytes(sessions.ticket_secret, sizeof(sessions.ticket_secret)) <= 0) {
+        goto cleanup;
+    }
+
+    if (cert_file) {
+        ctx = create_context_from_files(cert_file, key_file, key_type);
+    } else {
+        ctx = create_context_with_cert(key_type);
+    }
     if (!ctx) goto cleanup;
+    if (configure_sessions(ctx) != 0) goto cleanup;
+    if (ktls && enable_ktls(ctx) != 0) goto cleanup;
+    if (offload_threads > 0 && offload_private_key(ctx, offload_threads) != 0) goto cleanup;
     
-    sockfd = create_socket(port);
-    if (sockfd < 0) goto cleanup;
-    
-    printf("Server listening on port %d\n", port);
-    
-    while(1) {
-        struct sockaddr_in addr;
-        unsigned int len = sizeof(addr);
-        SSL *ssl;
-        char buf[BUFFER_SIZE];
-        int client;
-        
-        client = accept(sockfd, (struct sockaddr*)&addr, &len);
-        if (client < 0) {
-            perror("accept");
-            continue;
+    for (; ready < threads; ready++) {
+        if (setup_worker(&workers[ready], ctx, port, verbose) != 0) {
+            ready++;
+            goto cleanup;
         }
-        
-        ssl = SSL_new(ctx);
-        SSL_set_fd(ssl, client);
-        
-        if (SSL_accept(ssl) <= 0) {
-            ERR_print_errors_fp(stderr);
-        } else {
-            int bytes = SSL_read(ssl, buf, sizeof(buf));
-            if (bytes > 0) {
-                printf("Received: %.*s", bytes, buf);
-                SSL_write(ssl, buf, bytes);
-            }
+    }
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started].thread, NULL, worker_loop, &workers[started]) != 0) {
+            fprintf(stderr, "pthread_create failed, running %d threads\n", started);
+            break;
         }
-        
-        SSL_free(ssl);
-        close(client);
     }
+    if (started == 0) goto cleanup;
     
-    ret = 0;
+    printf("Server listening on port %d with %d threads\n", port, started);
+    fflush(stdout);
+    
+    /* Workers never return; on interrupt the counters are printed and the
+     * process exits without freeing the context they are still using. */
+    sigwait(&stop_signals, &sig);
+    print_stats();
+    _exit(0);
 
 cleanup:
     if (ret != 0) {
         ERR_print_errors_fp(stderr);
     }
-    if (sockfd >= 0) close(sockfd);
+    for (int i = 0; i < ready; i++) {
+        if (workers[i].epoll_fd >= 0) close(workers[i].epoll_fd);
+        if (workers[i].listen_fd >= 0) close(workers[i].listen_fd);
+    }
+    free(workers);
     SSL_CTX_free(ctx);
+    if (served.fd >= 0) close(served.fd);
+    OPENSSL_cleanse(sessions.ticket_secret, sizeof(sessions.ticket_secret));
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
     ERR_free_strings();
@@ -9,6 +9,7 @@ option(USE_SHARED "Use shared libraries" OFF)
 option(USE_SYSTEM "Use libraries installed in system" OFF)
 option(ENHANCE_SECURITY "Enhance OpenSSL security(e.g. TLS 1.3)" OFF)
 option(ENABLE_TESTS "Enable OpenSSL tests" OFF)
+option(ENABLE_KTLS "Enable kernel TLS offload (Linux, OpenSSL 3.0 or later)" OFF)
 
 function(detect_openssl_target)
   if(CMAKE_SYSTEM_NAME STREQUAL "Linux")
@@ -141,6 +142,9 @@ elseif(DEFINED OPENSSL_DIR AND EXISTS ${OPENSSL_DIR})
   if(NOT ENABLE_TESTS)
     list(APPEND BUILD_OPTIONS "no-tests")
   endif()
+  if(ENABLE_KTLS)
+    list(APPEND BUILD_OPTIONS "enable-ktls")
+  endif()
 
   ProcessorCount(NPROCS)
   if(NPROCS EQUAL 0)
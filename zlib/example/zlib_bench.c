@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define DEFAULT_CORPUS_MIB 4
+#define MAX_CORPUS 32
+
+struct corpus {
+    char name[256];
+    unsigned char* data;
+    size_t size;
+};
+
+struct strategy {
+    const char* name;
+    int value;
+};
+
+static const struct strategy strategies[] = {
+    { "default", Z_DEFAULT_STRATEGY },
+    { "filtered", Z_FILTERED },
+    { "rle", Z_RLE },
+    { "huffman_only", Z_HUFFMAN_ONLY },
+};
+
+static const int window_bits[] = { 9, 12, 15 };
+static const int mem_levels[] = { 1, 8, 9 };
+
+/* zlib allocations go through these so every run reports its own peak heap,
+ * which process-wide RSS cannot attribute to a single configuration. */
+static size_t heap_current;
+static size_t heap_peak;
+
+static voidpf bench_alloc(voidpf opaque, uInt items, uInt size) {
+    (void)opaque;
+    size_t len = (size_t)items * size;
+    size_t* p = malloc(len + sizeof(size_t));
+    if (!p) {
+        return Z_NULL;
+    }
+    *p = len;
+    heap_current += len;
+    if (heap_current > heap_peak) {
+        heap_peak = heap_current;
+    }
+    return p + 1;
+}
+
+static void bench_free(voidpf opaque, voidpf address) {
+    (void)opaque;
+    size_t* p = (size_t*)address - 1;
+    heap_current -= *p;
+    free(p);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kib(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static unsigned long next_random(unsigned long* state) {
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return *state >> 33;
+}
+
+static void make_text(struct corpus* c, size_t size, unsigned long seed) {
+    static const char* words[] = {
+        "the", "of", "and", "compression", "stream", "window", "level", "data",
+        "block", "header", "zlib", "buffer", "input", "output", "match", "length",
+        "distance", "huffman", "literal", "deflate", "inflate", "checksum", "a", "to",
+    };
+    size_t n = 0;
+    while (n < size) {
+        const char* w = words[next_random(&seed) % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(w);
+        for (size_t i = 0; i < len && n < size; i++) {
+            c->data[n++] = (unsigned char)w[i];
+        }
+        if (n < size) {
+            c->data[n++] = next_random(&seed) % 12 == 0 ? '\n' : ' ';
+        }
+    }
+}
+
+static void make_json(struct corpus* c, size_t size, unsigned long seed) {
+    size_t n = 0;
+    unsigned long id = 0;
+    while (n < size) {
+        char record[160];
+        int len = snprintf(record, sizeof(record),
+            "{\"id\":%lu,\"user\":\"user%lu\",\"score\":%lu.%02lu,\"active\":%s,\"tags\":[\"t%lu\",\"t%lu\"]},\n",
+            id++, next_random(&seed) % 5000, next_random(&seed) % 1000, next_random(&seed) % 100,
+            next_random(&seed) % 2 ? "true" : "false", next_random(&seed) % 16, next_random(&seed) % 16);
+        for (int i = 0; i < len && n < size; i++) {
+            c->data[n++] = (unsigned char)record[i];
+        }
+    }
+}
+
+/* Little-endian records with slowly changing counters and noisy samples,
+ * roughly what telemetry or executable data looks like to deflate. */
+static void make_binary(struct corpus* c, size_t size, unsigned long seed) {
+    unsigned long counter = 0;
+    for (size_t n = 0; n < size; n++) {
+        switch (n % 16) {
+        case 0:
+            counter += next_random(&seed) % 4;
+            /* fall through */
+        case 1: case 2: case 3:
+            c->data[n] = (unsigned char)(counter >> (8 * (n % 4)));
+            break;
+        case 4: case 5:
+            c->data[n] = (unsigned char)next_random(&seed);
+            break;
+        default:
+            c->data[n] = (unsigned char)(n % 16 < 10 ? 0 : n % 7);
+            break;
+        }
+    }
+}
+
+static int make_compressed(struct corpus* c, size_t size, unsigned long seed) {
+    struct corpus text;
+    text.size = size * 8;
+    text.data = malloc(text.size);
+    if (!text.data) {
+        return -1;
+    }
+    make_text(&text, text.size, seed);
+
+    /* Compress several times the target size of text and keep the first part
+     * of the output, so the result really is already-compressed data. */
+    unsigned char* out = malloc(compressBound((uLong)text.size));
+    uLongf full = compressBound((uLong)text.size);
+    int ret = out ? compress2(out, &full, text.data, (uLong)text.size, 9) : Z_MEM_ERROR;
+    if (ret == Z_OK) {
+        c->size = full < size ? full : size;
+        memcpy(c->data, out, c->size);
+    }
+    free(out);
+    free(text.data);
+    return ret == Z_OK ? 0 : -1;
+}
+
+static int load_file(struct corpus* c, const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open corpus file: %s\n", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    c->data = malloc(size > 0 ? (size_t)size : 1);
+    if (!c->data || fread(c->data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "Failed to read corpus file: %s\n", path);
+        free(c->data);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    const char* base = strrchr(path, '/');
+    snprintf(c->name, sizeof(c->name), "%s", base ? base + 1 : path);
+    c->size = (size_t)size;
+    return 0;
+}
+
+static int make_builtin(struct corpus* corpora, size_t size) {
+    static const char* names[] = { "text", "json", "binary", "compressed" };
+    for (int i = 0; i < 4; i++) {
+        struct corpus* c = &corpora[i];
+        snprintf(c->name, sizeof(c->name), "%s", names[i]);
+        c->size = size;
+        c->data = malloc(size);
+        if (!c->data) {
+            return -1;
+        }
+    }
+    make_text(&corpora[0], size, 1);
+    make_json(&corpora[1], size, 2);
+    make_binary(&corpora[2], size, 3);
+    return make_compressed(&corpora[3], size, 4) == 0 ? 4 : -1;
+}
+
+/* compressBound() only covers the default window and memLevel; a small
+ * window or memLevel on incompressible input needs more, so the output
+ * buffer is sized for the worst configuration in the sweep. */
+static size_t deflate_cap(size_t len) {
+    size_t cap = compressBound((uLong)len);
+    for (int level = 0; level <= 9; level++) {
+        for (size_t wi = 0; wi < sizeof(window_bits) / sizeof(window_bits[0]); wi++) {
+            for (size_t mi = 0; mi < sizeof(mem_levels) / sizeof(mem_levels[0]); mi++) {
+                z_stream strm;
+                memset(&strm, 0, sizeof(strm));
+                if (deflateInit2(&strm, level, Z_DEFLATED, window_bits[wi], mem_levels[mi],
+                                 Z_DEFAULT_STRATEGY) != Z_OK) {
+                    continue;
+                }
+                size_t bound = deflateBound(&strm, (uLong)len);
+                if (bound > cap) {
+                    cap = bound;
+                }
+                deflateEnd(&strm);
+            }
+        }
+    }
+    return cap;
+}
+
+struct result {
+    size_t compressed;
+    double compress_mbps;
+    double decompress_mbps;
+    size_t heap_peak;
+};
+
+static int run_deflate(const struct corpus* c, unsigned char* out, size_t out_cap,
+                       int level, int strategy, int wbits, int mem_level, size_t* out_len) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    strm.zalloc = bench_alloc;
+    strm.zfree = bench_free;
+
+    if (deflateInit2(&strm, level, Z_DEFLATED, wbits, mem_level, strategy) != Z_OK) {
+        return -1;
+    }
+    strm.next_in = c->data;
+    strm.avail_in = (uInt)c->size;
+    strm.next_out = out;
+    strm.avail_out = (uInt)out_cap;
+
+    int ret = deflate(&strm, Z_FINISH);
+    *out_len = out_cap - strm.avail_out;
+    deflateEnd(&strm);
+    return ret == Z_STREAM_END ? 0 : -1;
+}
+
+static int run_inflate(const unsigned char* in, size_t in_len, unsigned char* out, size_t out_cap,
+                       int wbits, size_t* out_len) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    strm.zalloc = bench_alloc;
+    strm.zfree = bench_free;
+
+    if (inflateInit2(&strm, wbits) != Z_OK) {
+        return -1;
+    }
+    strm.next_in = (unsigned char*)in;
+    strm.avail_in = (uInt)in_len;
+    strm.next_out = out;
+    strm.avail_out = (uInt)out_cap;
+
+    int ret = inflate(&strm, Z_FINISH);
+    *out_len = out_cap - strm.avail_out;
+    inflateEnd(&strm);
+    return ret == Z_STREAM_END ? 0 : -1;
+}
+
+static int bench_one(const struct corpus* c, unsigned char* comp, size_t comp_cap,
+                     unsigned char* plain, int level, int strategy, int wbits, int mem_level,
+                     int repeat, struct result* r) {
+    double best_c = 0;
+    double best_d = 0;
+    size_t plain_len = 0;
+
+    heap_peak = 0;
+    for (int i = 0; i < repeat; i++) {
+        double start = now_seconds();
+        if (run_deflate(c, comp, comp_cap, level, strategy, wbits, mem_level, &r->compressed) != 0) {
+            return -1;
+        }
+        double t = now_seconds() - start;
+        if (i == 0 || t < best_c) {
+            best_c = t;
+        }
+
+        start = now_seconds();
+        if (run_inflate(comp, r->compressed, plain, c->size, wbits, &plain_len) != 0) {
+            return -1;
+        }
+        t = now_seconds() - start;
+        if (i == 0 || t < best_d) {
+            best_d = t;
+        }
+    }
+
+    if (plain_len != c->size || memcmp(plain, c->data, c->size) != 0) {
+        return -1;
+    }
+
+    double mb = c->size / (1024.0 * 1024.0);
+    r->compress_mbps = best_c > 0 ? mb / best_c : 0;
+    r->decompress_mbps = best_d > 0 ? mb / best_d : 0;
+    r->heap_peak = heap_peak;
+    return 0;
+}
+
+/* Corpus names come from file names, so they are escaped for JSON and
+ * quoted for CSV rather than written as is. */
+static void write_json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') {
+            fprintf(f, "\\%c", ch);
+        } else if (ch < 0x20) {
+            fprintf(f, "\\u%04x", ch);
+        } else {
+            fputc(ch, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void write_csv_field(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"') {
+            fputc('"', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void print_usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--csv file] [--json file] [--quick] [--repeat N] [--size MiB] [corpus files...]\n", prog);
+    fprintf(stderr, "  Results go to stdout as CSV unless --csv or --json is given.\n");
+    fprintf(stderr, "  Without corpus files, built-in text, json, binary and compressed samples are used.\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct corpus corpora[MAX_CORPUS];
+    int count = 0;
+    int quick = 0;
+    int repeat = 3;
+    long size_mib = DEFAULT_CORPUS_MIB;
+    const char* csv_path = NULL;
+    const char* json_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = 1;
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size_mib = atol(argv[++i]);
+        } else if (argv[i][0] != '-' && count < MAX_CORPUS) {
+            if (load_file(&corpora[count], argv[i]) != 0) {
+                return 1;
+            }
+            count++;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (repeat < 1 || size_mib < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (count == 0) {
+        count = make_builtin(corpora, (size_t)size_mib << 20);
+        if (count < 0) {
+            fprintf(stderr, "Failed to generate corpus\n");
+            return 1;
+        }
+    }
+
+    FILE* csv = csv_path || json_path ? NULL : stdout;
+    FILE* json = NULL;
+    if (csv_path && !(csv = fopen(csv_path, "w"))) {
+        fprintf(stderr, "Cannot create output file: %s\n", csv_path);
+        return 1;
+    }
+    if (json_path && !(json = fopen(json_path, "w"))) {
+        fprintf(stderr, "Cannot create output file: %s\n", json_path);
+        return 1;
+    }
+
+    size_t largest = 0;
+    for (int i = 0; i < count; i++) {
+        if (corpora[i].size > largest) {
+            largest = corpora[i].size;
+        }
+    }
+    size_t comp_cap = deflate_cap(largest);
+    unsigned char* comp = malloc(comp_cap);
+    unsigned char* plain = malloc(largest > 0 ? largest : 1);
+    if (!comp || !plain) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    int n_wbits = quick ? 1 : (int)(sizeof(window_bits) / sizeof(window_bits[0]));
+    int n_mem = quick ? 1 : (int)(sizeof(mem_levels) / sizeof(mem_levels[0]));
+    int first = 1;
+    int failed = 0;
+
+    if (json) {
+        fprintf(json, "{\n  \"zlib_version\": \"%s\",\n  \"results\": [\n", zlibVersion());
+    }
+    if (csv) {
+        fprintf(csv, "zlib_version,corpus,bytes,level,strategy,window_bits,mem_level,"
+                     "compressed,ratio,compress_mbps,decompress_mbps,heap_peak_kib,rss_peak_kib\n");
+    }
+
+    for (int ci = 0; ci < count; ci++) {
+        const struct corpus* c = &corpora[ci];
+        for (int level = 0; level <= 9; level++) {
+            for (size_t si = 0; si < sizeof(strategies) / sizeof(strategies[0]); si++) {
+                for (int wi = 0; wi < n_wbits; wi++) {
+                    for (int mi = 0; mi < n_mem; mi++) {
+                        /* --quick keeps zlib's defaults: 32K window, memLevel 8. */
+                        int wbits = quick ? 15 : window_bits[wi];
+                        int mem_level = quick ? 8 : mem_levels[mi];
+                        struct result r;
+                        if (bench_one(c, comp, comp_cap, plain, level, strategies[si].value,
+                                      wbits, mem_level, repeat, &r) != 0) {
+                            fprintf(stderr, "Round trip failed: %s level %d %s wbits %d memLevel %d\n",
+                                    c->name, level, strategies[si].name, wbits, mem_level);
+                            failed = 1;
+                            continue;
+                        }
+
+                        double ratio = r.compressed > 0 ? (double)c->size / r.compressed : 0;
+                        if (json) {
+                            fprintf(json, "%s    {\"corpus\": ", first ? "" : ",\n");
+                            write_json_string(json, c->name);
+                            fprintf(json, ", \"bytes\": %zu, \"level\": %d, "
+                                         "\"strategy\": \"%s\", \"window_bits\": %d, \"mem_level\": %d, "
+                                         "\"compressed\": %zu, \"ratio\": %.4f, \"compress_mbps\": %.2f, "
+                                         "\"decompress_mbps\": %.2f, \"heap_peak_kib\": %zu, \"rss_peak_kib\": %ld}",
+                                    c->size, level, strategies[si].name,
+                                    wbits, mem_level, r.compressed, ratio, r.compress_mbps,
+                                    r.decompress_mbps, r.heap_peak / 1024, peak_rss_kib());
+                            fflush(json);
+                        }
+                        if (csv) {
+                            fprintf(csv, "%s,", zlibVersion());
+                            write_csv_field(csv, c->name);
+                            fprintf(csv, ",%zu,%d,%s,%d,%d,%zu,%.4f,%.2f,%.2f,%zu,%ld\n",
+                                    c->size, level, strategies[si].name,
+                                    wbits, mem_level, r.compressed, ratio, r.compress_mbps,
+                                    r.decompress_mbps, r.heap_peak / 1024, peak_rss_kib());
+                            fflush(csv);
+                        }
+                        first = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    if (csv && csv != stdout) {
+        fclose(csv);
+    }
+    for (int i = 0; i < count; i++) {
+        free(corpora[i].data);
+    }
+    free(comp);
+    free(plain);
+    return failed ? 1 : 0;
+}
@@ -1,71 +1,637 @@
+#define _FILE_OFFSET_BITS 64
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <zlib.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #define CHUNK 16384
+#define BLOCK_SIZE (128 * 1024)
+#define DICT_SIZE 32768
+#define MAX_JOBS 64
+#define INDEX_MAGIC "ZIX2"
+#define INDEX_HEADER_SIZE 24
+#define DEFAULT_SPAN_MIB 4
+#define DEFAULT_BUFFER_KIB 1024
+#define MAX_BUFFER_KIB (1024 * 1024)
+#define BUFFER_ALIGN 4096
 
-int compress_file(const char* input_path, const char* output_path) {
-    FILE* input = fopen(input_path, "rb");
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+enum block_state { BLOCK_FREE, BLOCK_READ, BLOCK_DONE };
+
+struct block {
+    uint64_t offset;
+    unsigned char *in;
+    size_t in_len;
+    /* Tail of the previous block, copied when this one is read because the
+     * previous slot may be refilled before this block is compressed. */
+    unsigned char *dict;
+    size_t dict_len;
+    unsigned char *out;
+    size_t out_len;
+    size_t out_cap;
+    uLong check;
+    int last;
+    int reset;
+    enum block_state state;
+};
+
+/* Block i always uses slot i % count. The reader fills a slot once the
+ * writer has released it, any worker compresses it, and the writer drains
+ * slots strictly in order, so memory stays at count blocks and no thread
+ * waits for a whole batch. */
+struct block_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct block *blocks;
+    int count;
+    int level;
+    uint64_t read_count;
+    uint64_t next_work;
+    uint64_t written;
+    int eof;
+    int failed;
+    FILE *output;
+    struct access_index *idx;
+    uLong check;
+    uint64_t total_out;
+};
+
+/* A point in the compressed stream where raw inflate can be restarted.
+ * Points recorded at compress time sit on full flushes and need no window;
+ * points found later by build_index() carry the preceding 32 KiB of output. */
+struct access_point {
+    uint64_t out;
+    uint64_t in;
+    int bits;
+    unsigned window_len;
+    unsigned char *window;
+};
+
+struct access_index {
+    struct access_point *points;
+    int count;
+    int cap;
+};
+
+static int index_add(struct access_index *idx, uint64_t out, uint64_t in, int bits,
+                     const unsigned char *window, unsigned window_len) {
+    if (idx->count == idx->cap) {
+        int cap = idx->cap ? idx->cap * 2 : 64;
+        struct access_point *points = realloc(idx->points, cap * sizeof(struct access_point));
+        if (!points) {
+            return -1;
+        }
+        idx->points = points;
+        idx->cap = cap;
+    }
+
+    struct access_point *point = &idx->points[idx->count];
+    point->window = NULL;
+    if (window_len > 0) {
+        point->window = malloc(window_len);
+        if (!point->window) {
+            return -1;
+        }
+        memcpy(point->window, window, window_len);
+    }
+    point->out = out;
+    point->in = in;
+    point->bits = bits;
+    point->window_len = window_len;
+    idx->count++;
+    return 0;
+}
+
+static void index_free(struct access_index *idx) {
+    for (int i = 0; i < idx->count; i++) {
+        free(idx->points[i].window);
+    }
+    free(idx->points);
+    memset(idx, 0, sizeof(*idx));
+}
+
+static void put_le(unsigned char *p, uint64_t v, int n) {
+    for (int i = 0; i < n; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const unsigned char *p, int n) {
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/* The index header records the size and modification time of the
+ * compressed file, so an index left over from an earlier version of the
+ * file is refused instead of returning the wrong bytes. */
+static int file_stamp(const char* path, uint64_t *size, uint64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    *size = (uint64_t)st.st_size;
+    *mtime = (uint64_t)st.st_mtime;
+    return 0;
+}
+
+int write_index(const char* index_path, const char* data_path, const struct access_index *idx) {
+    uint64_t size, mtime;
+    if (file_stamp(data_path, &size, &mtime) != 0) {
+        fprintf(stderr, "Cannot stat compressed file: %s\n", data_path);
+        return -1;
+    }
+
+    FILE* output = fopen(index_path, "wb");
+    if (!output) {
+        fprintf(stderr, "Cannot create index file: %s\n", index_path);
+        return -1;
+    }
+
+    unsigned char header[INDEX_HEADER_SIZE];
+    memcpy(header, INDEX_MAGIC, 4);
+    put_le(header + 4, (uint64_t)idx->count, 4);
+    put_le(header + 8, size, 8);
+    put_le(header + 16, mtime, 8);
+    int ok = fwrite(header, 1, sizeof(header), output) == sizeof(header);
+
+    for (int i = 0; ok && i < idx->count; i++) {
+        const struct access_point *point = &idx->points[i];
+        unsigned char entry[21];
+        put_le(entry, point->out, 8);
+        put_le(entry + 8, point->in, 8);
+        entry[16] = (unsigned char)point->bits;
+        put_le(entry + 17, point->window_len, 4);
+        ok = fwrite(entry, 1, sizeof(entry), output) == sizeof(entry)
+            && fwrite(point->window, 1, point->window_len, output) == point->window_len;
+    }
+
+    if (fclose(output) != 0 || !ok) {
+        fprintf(stderr, "Failed to write index file: %s\n", index_path);
+        return -1;
+    }
+    return 0;
+}
+
+int read_index(const char* index_path, const char* data_path, struct access_index *idx) {
+    uint64_t size, mtime;
+    if (file_stamp(data_path, &size, &mtime) != 0) {
+        fprintf(stderr, "Cannot stat compressed file: %s\n", data_path);
+        return -1;
+    }
+
+    FILE* input = fopen(index_path, "rb");
     if (!input) {
+        fprintf(stderr, "Cannot open index file: %s\n", index_path);
+        return -1;
+    }
+
+    unsigned char header[INDEX_HEADER_SIZE];
+    unsigned char window[DICT_SIZE];
+    int ok = fread(header, 1, sizeof(header), input) == sizeof(header)
+        && memcmp(header, INDEX_MAGIC, 4) == 0;
+    if (ok && (get_le(header + 8, 8) != size || get_le(header + 16, 8) != mtime)) {
+        fprintf(stderr, "Index file is out of date: %s\n", index_path);
+        fclose(input);
+        return -1;
+    }
+    uint64_t count = ok ? get_le(header + 4, 4) : 0;
+
+    for (uint64_t i = 0; ok && i < count; i++) {
+        unsigned char entry[21];
+        ok = fread(entry, 1, sizeof(entry), input) == sizeof(entry);
+        unsigned window_len = ok ? (unsigned)get_le(entry + 17, 4) : 0;
+        ok = ok && entry[16] < 8 && window_len <= DICT_SIZE
+            && fread(window, 1, window_len, input) == window_len
+            && index_add(idx, get_le(entry, 8), get_le(entry + 8, 8), entry[16], window, window_len) == 0;
+    }
+    fclose(input);
+
+    if (!ok || idx->count == 0) {
+        fprintf(stderr, "Invalid index file: %s\n", index_path);
+        index_free(idx);
+        return -1;
+    }
+    return 0;
+}
+
+/* Input is mapped and handed to zlib in place where the platform allows it,
+ * and read into one large buffer otherwise. */
+struct input_source {
+    FILE* file;
+    unsigned char* map;
+    unsigned char* buf;
+    uint64_t size;
+    uint64_t pos;
+    uint64_t dropped;
+    size_t buf_size;
+    int error;
+};
+
+static unsigned char* alloc_buffer(size_t size) {
+#ifdef _WIN32
+    return malloc(size);
+#else
+    void* buf = NULL;
+    return posix_memalign(&buf, BUFFER_ALIGN, size) == 0 ? buf : NULL;
+#endif
+}
+
+static int source_open(struct input_source* src, const char* path, size_t buf_size) {
+    memset(src, 0, sizeof(*src));
+    src->buf_size = buf_size;
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    /* A file larger than the address space (4 GiB or more on 32-bit
+     * targets) is read through the buffer instead. */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (uint64_t)st.st_size <= SIZE_MAX) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            src->map = map;
+            src->size = (uint64_t)st.st_size;
+            close(fd);
+            return 0;
+        }
+    }
+    close(fd);
+#endif
+
+    src->file = fopen(path, "rb");
+    src->buf = src->file ? alloc_buffer(buf_size) : NULL;
+    if (!src->buf) {
+        if (src->file) {
+            fclose(src->file);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns the next slice of at most max bytes, or 0 at end of input. */
+static size_t source_next(struct input_source* src, unsigned char** data, size_t max) {
+    if (max > src->buf_size) {
+        max = src->buf_size;
+    }
+
+    if (src->map) {
+#ifndef _WIN32
+        /* Drop pages that were already consumed so large inputs do not
+         * accumulate in the resident set. */
+        uint64_t done = src->pos & ~(uint64_t)(BUFFER_ALIGN - 1);
+        if (done > src->dropped) {
+            madvise(src->map + src->dropped, (size_t)(done - src->dropped), MADV_DONTNEED);
+            src->dropped = done;
+        }
+#endif
+        uint64_t left = src->size - src->pos;
+        size_t len = left < max ? (size_t)left : max;
+        *data = src->map + src->pos;
+        src->pos += len;
+        return len;
+    }
+
+    size_t len = fread(src->buf, 1, max, src->file);
+    if (ferror(src->file)) {
+        src->error = 1;
+        return 0;
+    }
+    *data = src->buf;
+    src->pos += len;
+    return len;
+}
+
+static int source_eof(struct input_source* src) {
+    return src->map ? src->pos == src->size : feof(src->file);
+}
+
+static void source_close(struct input_source* src) {
+#ifndef _WIN32
+    if (src->map) {
+        munmap(src->map, (size_t)src->size);
+    }
+#endif
+    if (src->file) {
+        fclose(src->file);
+    }
+    free(src->buf);
+}
+
+static FILE* open_output(const char* path) {
+    FILE* output = fopen(path, "wb");
+    if (output) {
+        /* Writes already come in large buffers, so skip stdio's copy. */
+        setvbuf(output, NULL, _IONBF, 0);
+    }
+    return output;
+}
+
+int compress_file(const char* input_path, const char* output_path, size_t buf_size,
+                  uint64_t span, struct access_index *idx) {
+    struct input_source src;
+    if (source_open(&src, input_path, buf_size) != 0) {
         fprintf(stderr, "Cannot open input file: %s\n", input_path);
         return -1;
     }
 
-    FILE* output = fopen(output_path, "wb");
+    FILE* output = open_output(output_path);
     if (!output) {
         fprintf(stderr, "Cannot create output file: %s\n", output_path);
-        fclose(input);
+        source_close(&src);
         return -1;
     }
 
-    unsigned char in[CHUNK];
-    unsigned char out[CHUNK];
+    unsigned char* out = alloc_buffer(buf_size);
     z_stream strm;
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
 
-    if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    if (!out || deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
         fprintf(stderr, "Failed to initialize deflate\n");
+        free(out);
+        source_close(&src);
+        fclose(output);
         return -1;
     }
 
-    do {
-        strm.avail_in = fread(in, 1, CHUNK, input);
-        if (ferror(input)) {
-            deflateEnd(&strm);
-            fclose(input);
-            fclose(output);
-            return -1;
-        }
+    /* Raw deflate data starts right after the two byte zlib header. Own
+     * counters are kept since z_stream totals are 32-bit on some platforms. */
+    uint64_t total_in = 0;
+    uint64_t total_out = 0;
+    uint64_t next_point = span;
+    int result = 0;
+    if (idx && index_add(idx, 0, 2, 0, NULL, 0) != 0) {
+        result = -1;
+    }
 
+    while (result == 0) {
+        unsigned char* in;
+        size_t max = idx ? (size_t)(next_point - total_in) : buf_size;
+        strm.avail_in = (uInt)source_next(&src, &in, max);
         strm.next_in = in;
+        total_in += strm.avail_in;
+        if (src.error) {
+            result = -1;
+            break;
+        }
+
+        int flush = Z_NO_FLUSH;
+        if (source_eof(&src)) {
+            flush = Z_FINISH;
+        } else if (idx && total_in >= next_point) {
+            flush = Z_FULL_FLUSH;
+        }
+
         do {
-            strm.avail_out = CHUNK;
+            strm.avail_out = (uInt)buf_size;
             strm.next_out = out;
 
-            deflate(&strm, feof(input) ? Z_FINISH : Z_NO_FLUSH);
-            
-            int have = CHUNK - strm.avail_out;
+            deflate(&strm, flush);
+
+            size_t have = buf_size - strm.avail_out;
+            total_out += have;
             if (fwrite(out, 1, have, output) != have || ferror(output)) {
-                deflateEnd(&strm);
-                fclose(input);
-                fclose(output);
-                return -1;
+                result = -1;
+                break;
             }
         } while (strm.avail_out == 0);
 
-    } while (!feof(input));
+        /* A full flush leaves no back references, so inflate can restart here. */
+        if (result == 0 && flush == Z_FULL_FLUSH) {
+            if (index_add(idx, total_in, total_out, 0, NULL, 0) != 0) {
+                result = -1;
+            }
+            next_point += span;
+        }
+
+        if (flush == Z_FINISH) {
+            break;
+        }
+    }
 
     deflateEnd(&strm);
-    fclose(input);
-    fclose(output);
+    free(out);
+    source_close(&src);
+    if (fclose(output) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/* Deflates one block as raw data primed with the tail of the previous block.
+ * Intermediate blocks end on a sync flush so they can be concatenated. */
+static int deflate_block(z_stream *strm, struct block *blk, const unsigned char *dict, size_t dict_len) {
+    if (deflateReset(strm) != Z_OK) {
+        return -1;
+    }
+    if (dict_len > 0 && deflateSetDictionary(strm, dict, (uInt)dict_len) != Z_OK) {
+        return -1;
+    }
+
+    size_t bound = deflateBound(strm, blk->in_len) + 16;
+    if (blk->out_cap < bound) {
+        unsigned char *out = realloc(blk->out, bound);
+        if (!out) {
+            return -1;
+        }
+        blk->out = out;
+        blk->out_cap = bound;
+    }
+
+    strm->next_in = blk->in;
+    strm->avail_in = (uInt)blk->in_len;
+    strm->next_out = blk->out;
+    strm->avail_out = (uInt)blk->out_cap;
+
+    int ret = deflate(strm, blk->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (ret == Z_STREAM_ERROR || strm->avail_in != 0 || (blk->last && ret != Z_STREAM_END)) {
+        return -1;
+    }
+
+    blk->out_len = blk->out_cap - strm->avail_out;
+    blk->check = adler32(1L, blk->in, (uInt)blk->in_len);
     return 0;
 }
 
-int decompress_file(const char* input_path, const char* output_path) {
-    FILE* input = fopen(input_path, "rb");
-    if (!input) {
+static void pool_fail(struct block_pool *pool, const char *message) {
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->failed) {
+        fprintf(stderr, "%s\n", message);
+        pool->failed = 1;
+    }
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* compress_worker(void *arg) {
+    struct block_pool *pool = arg;
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    int ok = deflateInit2(&strm, pool->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!ok) {
+        pool_fail(pool, "Failed to initialize deflate");
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->failed && !pool->eof && pool->next_work >= pool->read_count) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->failed || pool->next_work >= pool->read_count) {
+            break;
+        }
+        struct block *blk = &pool->blocks[pool->next_work++ % pool->count];
+        pthread_mutex_unlock(&pool->lock);
+
+        if (deflate_block(&strm, blk, blk->dict, blk->reset ? 0 : blk->dict_len) != 0) {
+            pool_fail(pool, "Failed to compress block");
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        blk->state = BLOCK_DONE;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (ok) {
+        deflateEnd(&strm);
+    }
+    return NULL;
+}
+
+/* Appends finished blocks in order, records their restart points and folds
+ * their checksums into the stream's adler32. */
+static void* block_writer(void *arg) {
+    struct block_pool *pool = arg;
+    int ok = 1;
+
+    pthread_mutex_lock(&pool->lock);
+    while (ok) {
+        struct block *blk = &pool->blocks[pool->written % pool->count];
+        while (!pool->failed && !(pool->eof && pool->written == pool->read_count)
+               && !(pool->written < pool->read_count && blk->state == BLOCK_DONE)) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->failed || pool->written == pool->read_count) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (blk->reset && index_add(pool->idx, blk->offset, pool->total_out, 0, NULL, 0) != 0) {
+            ok = 0;
+        }
+        ok = ok && fwrite(blk->out, 1, blk->out_len, pool->output) == blk->out_len;
+        pool->total_out += blk->out_len;
+        pool->check = adler32_combine(pool->check, blk->check, (z_off_t)blk->in_len);
+
+        pthread_mutex_lock(&pool->lock);
+        blk->state = BLOCK_FREE;
+        pool->written++;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!ok) {
+        pool_fail(pool, "Failed to write output file");
+    }
+    return NULL;
+}
+
+/* Reads blocks into the ring on the calling thread while the workers and
+ * the writer run. */
+static void read_blocks(struct block_pool *pool, struct input_source *src, uint64_t span) {
+    const struct block *prev = NULL;
+    uint64_t total_in = 0;
+
+    for (uint64_t i = 0;; i++) {
+        struct block *blk = &pool->blocks[i % pool->count];
+
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->failed && blk->state != BLOCK_FREE) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        int failed = pool->failed;
+        pthread_mutex_unlock(&pool->lock);
+        if (failed) {
+            return;
+        }
+
+        /* Blocks are copied out of the mapping or the -b read buffer, so
+         * the source can move on while they wait for a worker. */
+        blk->offset = total_in;
+        blk->in_len = 0;
+        while (blk->in_len < BLOCK_SIZE && !source_eof(src)) {
+            unsigned char *data;
+            size_t len = source_next(src, &data, BLOCK_SIZE - blk->in_len);
+            if (len == 0) {
+                break;
+            }
+            memcpy(blk->in + blk->in_len, data, len);
+            blk->in_len += len;
+        }
+        if (src->error) {
+            pool_fail(pool, "Failed to read input file");
+            return;
+        }
+        total_in += blk->in_len;
+        blk->dict_len = 0;
+        if (prev) {
+            blk->dict_len = prev->in_len < DICT_SIZE ? prev->in_len : DICT_SIZE;
+            memcpy(blk->dict, prev->in + prev->in_len - blk->dict_len, blk->dict_len);
+        }
+        /* Blocks that open an index span are compressed without a
+         * dictionary, which makes their start a restart point. */
+        blk->reset = pool->idx && blk->offset % span == 0;
+        blk->last = source_eof(src) ? 1 : 0;
+        prev = blk;
+
+        pthread_mutex_lock(&pool->lock);
+        blk->state = BLOCK_READ;
+        pool->read_count++;
+        pool->eof = blk->last;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+        if (blk->last) {
+            return;
+        }
+    }
+}
+
+static void write_be32(unsigned char *p, uLong v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+int compress_file_parallel(const char* input_path, const char* output_path, int jobs,
+                           size_t buf_size, uint64_t span, struct access_index *idx) {
+    struct input_source src;
+    if (source_open(&src, input_path, buf_size) != 0) {
         fprintf(stderr, "Cannot open input file: %s\n", input_path);
         return -1;
     }
@@ -73,12 +639,104 @@ int decompress_file(const char* input_path, const char* output_path) {
     FILE* output = fopen(output_path, "wb");
     if (!output) {
         fprintf(stderr, "Cannot create output file: %s\n", output_path);
-        fclose(input);
+        source_close(&src);
         return -1;
     }
 
-    unsigned char in[CHUNK];
-    unsigned char out[CHUNK];
+    /* Two slots per worker, plus one being read and one being written. */
+    struct block_pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.count = jobs * 2 + 2;
+    pool.level = Z_DEFAULT_COMPRESSION;
+    pool.output = output;
+    pool.idx = idx;
+    pool.blocks = calloc(pool.count, sizeof(struct block));
+    int result = pool.blocks ? 0 : -1;
+    for (int i = 0; result == 0 && i < pool.count; i++) {
+        pool.blocks[i].in = malloc(BLOCK_SIZE);
+        pool.blocks[i].dict = malloc(DICT_SIZE);
+        if (!pool.blocks[i].in || !pool.blocks[i].dict) {
+            result = -1;
+        }
+    }
+    if (result != 0) {
+        fprintf(stderr, "Out of memory\n");
+    }
+
+    /* zlib header: 32K window, level hint matching the default level. */
+    unsigned char header[2] = { 0x78, 0x9c };
+    if (result == 0 && fwrite(header, 1, sizeof(header), output) != sizeof(header)) {
+        result = -1;
+    }
+    pool.check = adler32(0L, Z_NULL, 0);
+    pool.total_out = sizeof(header);
+
+    pthread_t threads[MAX_JOBS];
+    pthread_t writer;
+    int started = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    int writer_started = result == 0 && pthread_create(&writer, NULL, block_writer, &pool) == 0;
+    for (; writer_started && started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, compress_worker, &pool) != 0) {
+            break;
+        }
+    }
+
+    if (writer_started && started > 0) {
+        read_blocks(&pool, &src, span);
+    } else if (result == 0) {
+        pool_fail(&pool, "Failed to start worker threads");
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (writer_started) {
+        pthread_join(writer, NULL);
+    }
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+
+    if (pool.failed) {
+        result = -1;
+    }
+    if (result == 0) {
+        unsigned char trailer[4];
+        write_be32(trailer, pool.check);
+        if (fwrite(trailer, 1, sizeof(trailer), output) != sizeof(trailer)) {
+            result = -1;
+        }
+    }
+
+    for (int i = 0; pool.blocks && i < pool.count; i++) {
+        free(pool.blocks[i].in);
+        free(pool.blocks[i].dict);
+        free(pool.blocks[i].out);
+    }
+    free(pool.blocks);
+    source_close(&src);
+    if (fclose(output) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+int decompress_file(const char* input_path, const char* output_path, size_t buf_size) {
+    struct input_source src;
+    if (source_open(&src, input_path, buf_size) != 0) {
+        fprintf(stderr, "Cannot open input file: %s\n", input_path);
+        return -1;
+    }
+
+    FILE* output = open_output(output_path);
+    if (!output) {
+        fprintf(stderr, "Cannot create output file: %s\n", output_path);
+        source_close(&src);
+        return -1;
+    }
+
+    unsigned char* out = alloc_buffer(buf_size);
     z_stream strm;
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
@@ -86,71 +744,346 @@ int decompress_file(const char* input_path, const char* output_path) {
     strm.avail_in = 0;
     strm.next_in = Z_NULL;
 
-    if (inflateInit(&strm) != Z_OK) {
+    if (!out || inflateInit(&strm) != Z_OK) {
         fprintf(stderr, "Failed to initialize inflate\n");
+        free(out);
+        source_close(&src);
+        fclose(output);
         return -1;
     }
 
-    do {
-        strm.avail_in = fread(in, 1, CHUNK, input);
-        if (ferror(input)) {
-            inflateEnd(&strm);
-            fclose(input);
-            fclose(output);
-            return -1;
+    int result = 0;
+    int ret = Z_OK;
+    while (result == 0 && ret != Z_STREAM_END) {
+        unsigned char* in;
+        strm.avail_in = (uInt)source_next(&src, &in, buf_size);
+        strm.next_in = in;
+        if (src.error) {
+            result = -1;
+            break;
         }
         if (strm.avail_in == 0)
             break;
 
-        strm.next_in = in;
         do {
-            strm.avail_out = CHUNK;
+            strm.avail_out = (uInt)buf_size;
             strm.next_out = out;
 
-            int ret = inflate(&strm, Z_NO_FLUSH);
+            ret = inflate(&strm, Z_NO_FLUSH);
             if (ret != Z_OK && ret != Z_STREAM_END) {
-                inflateEnd(&strm);
-                fclose(input);
-                fclose(output);
-                return -1;
+                result = -1;
+                break;
             }
 
-            int have = CHUNK - strm.avail_out;
+            size_t have = buf_size - strm.avail_out;
             if (fwrite(out, 1, have, output) != have || ferror(output)) {
-                inflateEnd(&strm);
-                fclose(input);
-                fclose(output);
-                return -1;
+                result = -1;
+                break;
             }
         } while (strm.avail_out == 0);
+    }
+
+    inflateEnd(&strm);
+    free(out);
+    source_close(&src);
+    if (fclose(output) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/* Walks an existing zlib or gzip stream and records a restart point at the
+ * first deflate block boundary after every span bytes of output. */
+int build_index(const char* input_path, uint64_t span, struct access_index *idx) {
+    FILE* input = fopen(input_path, "rb");
+    if (!input) {
+        fprintf(stderr, "Cannot open input file: %s\n", input_path);
+        return -1;
+    }
+
+    unsigned char in[CHUNK];
+    unsigned char window[DICT_SIZE];
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+
+    if (inflateInit2(&strm, 47) != Z_OK) {
+        fprintf(stderr, "Failed to initialize inflate\n");
+        fclose(input);
+        return -1;
+    }
+
+    uint64_t total_in = 0;
+    uint64_t total_out = 0;
+    uint64_t last = 0;
+    int ret = Z_OK;
+    strm.avail_out = 0;
+
+    do {
+        strm.avail_in = fread(in, 1, CHUNK, input);
+        if (ferror(input) || strm.avail_in == 0) {
+            ret = Z_DATA_ERROR;
+            break;
+        }
+        strm.next_in = in;
+
+        do {
+            if (strm.avail_out == 0) {
+                strm.avail_out = DICT_SIZE;
+                strm.next_out = window;
+            }
 
-    } while (1);
+            total_in += strm.avail_in;
+            total_out += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);
+            total_in -= strm.avail_in;
+            total_out -= strm.avail_out;
+
+            if (ret == Z_NEED_DICT || ret == Z_MEM_ERROR || ret == Z_DATA_ERROR) {
+                ret = Z_DATA_ERROR;
+                break;
+            }
+            if (ret == Z_STREAM_END) {
+                break;
+            }
+
+            /* Bit 7 marks the end of a block header, bit 6 the last block. */
+            if ((strm.data_type & 128) && !(strm.data_type & 64)
+                && (total_out == 0 || total_out - last > span)) {
+                unsigned char linear[DICT_SIZE];
+                unsigned left = strm.avail_out;
+                unsigned have = total_out < DICT_SIZE ? (unsigned)total_out : DICT_SIZE;
+                memcpy(linear, window + DICT_SIZE - left, left);
+                memcpy(linear + left, window, DICT_SIZE - left);
+                if (index_add(idx, total_out, total_in, strm.data_type & 7,
+                              linear + DICT_SIZE - have, have) != 0) {
+                    ret = Z_MEM_ERROR;
+                    break;
+                }
+                last = total_out;
+            }
+        } while (strm.avail_in != 0);
+    } while (ret == Z_OK);
 
     inflateEnd(&strm);
     fclose(input);
-    fclose(output);
+
+    if (ret != Z_STREAM_END) {
+        fprintf(stderr, "Failed to index compressed stream\n");
+        index_free(idx);
+        return -1;
+    }
     return 0;
 }
 
+/* Inflates len bytes starting at uncompressed offset from the closest
+ * access point at or before it. */
+int extract_range(const char* input_path, const struct access_index *idx,
+                  uint64_t offset, uint64_t len, FILE* output) {
+    const struct access_point *point = &idx->points[0];
+    for (int i = 1; i < idx->count && idx->points[i].out <= offset; i++) {
+        point = &idx->points[i];
+    }
+
+    FILE* input = fopen(input_path, "rb");
+    if (!input) {
+        fprintf(stderr, "Cannot open input file: %s\n", input_path);
+        return -1;
+    }
+
+    unsigned char in[CHUNK];
+    unsigned char out[CHUNK];
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+
+    if (inflateInit2(&strm, -15) != Z_OK) {
+        fprintf(stderr, "Failed to initialize inflate\n");
+        fclose(input);
+        return -1;
+    }
+
+    int ret = Z_OK;
+    if (fseek64(input, (long long)point->in - (point->bits ? 1 : 0), SEEK_SET) != 0) {
+        ret = Z_ERRNO;
+    } else if (point->bits) {
+        int c = getc(input);
+        if (c == EOF) {
+            ret = Z_DATA_ERROR;
+        } else {
+            inflatePrime(&strm, point->bits, c >> (8 - point->bits));
+        }
+    }
+    if (ret == Z_OK && point->window_len > 0) {
+        ret = inflateSetDictionary(&strm, point->window, point->window_len);
+    }
+
+    uint64_t skip = offset - point->out;
+    while (ret == Z_OK && len > 0) {
+        if (strm.avail_in == 0) {
+            strm.avail_in = fread(in, 1, CHUNK, input);
+            if (ferror(input) || strm.avail_in == 0) {
+                ret = Z_DATA_ERROR;
+                break;
+            }
+            strm.next_in = in;
+        }
+
+        strm.avail_out = CHUNK;
+        strm.next_out = out;
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            break;
+        }
+
+        size_t have = CHUNK - strm.avail_out;
+        size_t start = 0;
+        if (skip > 0) {
+            start = skip < have ? (size_t)skip : have;
+            skip -= start;
+        }
+        size_t take = have - start;
+        if (take > len) {
+            take = (size_t)len;
+        }
+        if (fwrite(out + start, 1, take, output) != take) {
+            ret = Z_ERRNO;
+            break;
+        }
+        len -= take;
+
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+    }
+
+    inflateEnd(&strm);
+    fclose(input);
+
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+        fprintf(stderr, "Failed to extract range\n");
+        return -1;
+    }
+    if (len > 0) {
+        fprintf(stderr, "Range extends past the end of the data\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void print_usage(const char* prog) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  Compress:    %s -c [-j threads] [-x span_mib] [-b buffer_kib] <file>\n", prog);
+    fprintf(stderr, "  Decompress:  %s -d [-b buffer_kib] <file.z>\n", prog);
+    fprintf(stderr, "  Build index: %s -i [-x span_mib] <file.z>\n", prog);
+    fprintf(stderr, "  Read range:  %s -r offset:len <file.z>\n", prog);
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 3 || (strcmp(argv[1], "-c") != 0 && strcmp(argv[1], "-d") != 0)) {
-        fprintf(stderr, "Usage:\n");
-        fprintf(stderr, "  Compress:   %s -c <file>\n", argv[0]);
-        fprintf(stderr, "  Decompress: %s -d <file.z>\n", argv[0]);
+    const char* mode = NULL;
+    const char* input_path = NULL;
+    const char* range = NULL;
+    int jobs = 1;
+    long span_mib = 0;
+    long buffer_kib = DEFAULT_BUFFER_KIB;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "-i") == 0) {
+            mode = argv[i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            mode = argv[i];
+            range = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            span_mib = atol(argv[++i]);
+            if (span_mib <= 0) {
+                fprintf(stderr, "Index span must be a positive number of MiB\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            buffer_kib = atol(argv[++i]);
+            if (buffer_kib < 16 || buffer_kib > MAX_BUFFER_KIB) {
+                fprintf(stderr, "Buffer size must be between 16 and %d KiB\n", MAX_BUFFER_KIB);
+                return 1;
+            }
+        } else if (!input_path && argv[i][0] != '-') {
+            input_path = argv[i];
+        } else {
+            mode = NULL;
+            break;
+        }
+    }
+
+    if (!mode || !input_path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (jobs < 1 || jobs > MAX_JOBS) {
+        fprintf(stderr, "Thread count must be between 1 and %d\n", MAX_JOBS);
         return 1;
     }
 
-    const char* input_path = argv[2];
     char output_path[1024];
+    char index_path[1040];
+    struct access_index idx = { NULL, 0, 0 };
+    uint64_t span = (uint64_t)(span_mib ? span_mib : DEFAULT_SPAN_MIB) << 20;
+    size_t buf_size = (size_t)buffer_kib << 10;
 
-    if (strcmp(argv[1], "-c") == 0) {
+    if (strcmp(mode, "-c") == 0) {
         snprintf(output_path, sizeof(output_path), "%s.z", input_path);
+        snprintf(index_path, sizeof(index_path), "%s.idx", output_path);
+        struct access_index *want = span_mib ? &idx : NULL;
         printf("Compressing %s to %s\n", input_path, output_path);
-        if (compress_file(input_path, output_path) != 0) {
+        int result = jobs > 1
+            ? compress_file_parallel(input_path, output_path, jobs, buf_size, span, want)
+            : compress_file(input_path, output_path, buf_size, span, want);
+        if (result == 0 && want) {
+            result = write_index(index_path, output_path, want);
+        }
+        index_free(&idx);
+        if (result != 0) {
             fprintf(stderr, "Compression failed\n");
             return 1;
         }
         printf("Compression completed\n");
+    } else if (strcmp(mode, "-i") == 0) {
+        snprintf(index_path, sizeof(index_path), "%s.idx", input_path);
+        printf("Indexing %s to %s\n", input_path, index_path);
+        int result = build_index(input_path, span, &idx);
+        if (result == 0) {
+            result = write_index(index_path, input_path, &idx);
+        }
+        index_free(&idx);
+        if (result != 0) {
+            fprintf(stderr, "Indexing failed\n");
+            return 1;
+        }
+        printf("Indexing completed\n");
+    } else if (strcmp(mode, "-r") == 0) {
+        unsigned long long offset;
+        unsigned long long len;
+        if (sscanf(range, "%llu:%llu", &offset, &len) != 2) {
+            fprintf(stderr, "Range must be given as offset:len\n");
+            return 1;
+        }
+        snprintf(index_path, sizeof(index_path), "%s.idx", input_path);
+        if (read_index(index_path, input_path, &idx) != 0) {
+            fprintf(stderr, "Build the index first with -i\n");
+            return 1;
+        }
+        int result = extract_range(input_path, &idx, offset, len, stdout);
+        index_free(&idx);
+        if (result != 0) {
+            return 1;
+        }
     } else {
         size_t len = strlen(input_path);
         if (len < 2 || input_path[len-2] != '.' || input_path[len-1] != 'z') {
@@ -161,7 +1094,7 @@ int main(int argc, char* argv[]) {
         output_path[len-2] = '\0';
         
         printf("Decompressing %s to %s\n", input_path, output_path);
-        if (decompress_file(input_path, output_path) != 0) {
+        if (decompress_file(input_path, output_path, buf_size) != 0) {
             fprintf(stderr, "Decompression failed\n");
             return 1;
         }
@@ -7,6 +7,12 @@ include(ProcessorCount)
 
 option(USE_SHARED "Use shared libraries" OFF)
 option(USE_SYSTEM "Use libraries installed in system" OFF)
+set(ZLIB_BACKEND "zlib" CACHE STRING "ZLib implementation built from ZLIB_DIR (zlib, zlib-ng)")
+set_property(CACHE ZLIB_BACKEND PROPERTY STRINGS zlib zlib-ng)
+
+if(NOT ZLIB_BACKEND MATCHES "^(zlib|zlib-ng)$")
+  message(FATAL_ERROR "Unsupported ZLIB_BACKEND: ${ZLIB_BACKEND} (expected zlib or zlib-ng)")
+endif()
 
 add_library(zlib INTERFACE)
 
@@ -147,10 +153,35 @@ elseif(DEFINED ZLIB_DIR AND EXISTS ${ZLIB_DIR})
   
   file(MAKE_DIRECTORY ${ZLIB_INCLUDE_DIR})
 
+  set(EXTRA_CMAKE_ARGS "")
+  if(DEFINED CMAKE_TOOLCHAIN_FILE)
+    list(APPEND EXTRA_CMAKE_ARGS "-DCMAKE_TOOLCHAIN_FILE=${CMAKE_TOOLCHAIN_FILE}")
+  endif()
+
+  # zlib-ng in compat mode installs a drop-in zlib.h and libz, so ZLIB::ZLIB
+  # and everything linking it stay unchanged. CPU features (AVX2/SSE4.2/NEON
+  # CRC, adler32, longest_match) are compiled in and picked at runtime.
+  # zlib-ng installs with GNUInstallDirs, which picks lib64 on some hosts;
+  # pin it to lib where ZLIB_LIB_DIR expects the library.
+  if(ZLIB_BACKEND STREQUAL "zlib-ng")
+    list(APPEND EXTRA_CMAKE_ARGS
+      -DCMAKE_INSTALL_LIBDIR=lib
+      -DZLIB_COMPAT=ON
+      -DWITH_OPTIM=ON
+      -DWITH_RUNTIME_CPU_DETECTION=ON
+      -DWITH_NEW_STRATEGIES=ON
+      -DZLIB_ENABLE_TESTS=OFF
+      -DZLIBNG_ENABLE_TESTS=OFF
+      -DWITH_GTEST=OFF
+      -DBUILD_SHARED_LIBS=${USE_SHARED}
+    )
+  endif()
+
   ExternalProject_Add(zlib_build
     SOURCE_DIR ${ZLIB_SOURCE_PATH}
     CMAKE_ARGS
       -DCMAKE_INSTALL_PREFIX=${DESTINATION_PATH}
+      ${EXTRA_CMAKE_ARGS}
       ${ZLIB_CMAKE_EXTRA}
     BUILD_COMMAND ${CMAKE_MAKE_PROGRAM} ${MAKE_PARALLEL}
     INSTALL_COMMAND ${CMAKE_MAKE_PROGRAM} ${MAKE_PARALLEL} install
@@ -181,5 +212,8 @@ else()
   message(FATAL_ERROR "Failed to build/load ZLib")
 endif()
 
+if(DEFINED ZLIB_SOURCE_PATH)
+  message(STATUS "Backend: ${ZLIB_BACKEND}")
+endif()
 message(STATUS "Include directory: ${ZLIB_INCLUDE_DIR}")
 message(STATUS "Library directory: ${ZLIB_LIB_DIR}")